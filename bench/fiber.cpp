@@ -0,0 +1,242 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "fiber.h"
+
+#if defined(_WIN32)
+#	define BENCH_FIBER_WINDOWS 1
+#	include <windows.h>
+#elif defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#	define BENCH_FIBER_X64 1
+#	include <sys/mman.h>
+#else
+#	define BENCH_FIBER_UCONTEXT 1
+#	include <sys/mman.h>
+#	include <ucontext.h>
+#endif
+
+#include <cstdint>
+
+using namespace bench;
+
+struct sched::Fiber
+{
+#if BENCH_FIBER_WINDOWS
+	void* handle;
+#elif BENCH_FIBER_X64
+	void* sp;
+#else
+	ucontext_t context;
+#endif
+
+	void* stack;
+	size_t stackSize;
+
+	sched::FiberEntry* entry;
+	void* entryContext;
+	bool convertedThread;
+};
+
+#if BENCH_FIBER_X64
+
+extern "C" void benchFiberSwitch(void** fromSp, void* toSp);
+extern "C" void benchFiberTrampoline();
+
+// saves callee-saved registers and the floating point control words on the
+// current stack, then restores them from the target stack
+asm(R"(
+	.text
+	.globl benchFiberSwitch
+	.type benchFiberSwitch, @function
+benchFiberSwitch:
+	pushq %rbp
+	pushq %rbx
+	pushq %r12
+	pushq %r13
+	pushq %r14
+	pushq %r15
+	subq $8, %rsp
+	stmxcsr (%rsp)
+	fnstcw 4(%rsp)
+	movq %rsp, (%rdi)
+	movq %rsi, %rsp
+	ldmxcsr (%rsp)
+	fldcw 4(%rsp)
+	addq $8, %rsp
+	popq %r15
+	popq %r14
+	popq %r13
+	popq %r12
+	popq %rbx
+	popq %rbp
+	ret
+	.size benchFiberSwitch, .-benchFiberSwitch
+
+	.globl benchFiberTrampoline
+	.type benchFiberTrampoline, @function
+benchFiberTrampoline:
+	movq %rbx, %rdi
+	call benchFiberStart
+	ud2
+	.size benchFiberTrampoline, .-benchFiberTrampoline
+)");
+
+extern "C" void benchFiberStart(sched::Fiber* fiber)
+{
+	sched::Fiber* next = fiber->entry(fiber, fiber->entryContext);
+
+	// the scheduler releases this fiber once it regains control
+	benchFiberSwitch(&fiber->sp, next->sp);
+}
+
+#elif BENCH_FIBER_UCONTEXT
+
+static void fiberStart(unsigned int lo, unsigned int hi)
+{
+	sched::Fiber* fiber = reinterpret_cast<sched::Fiber*>((static_cast<uintptr_t>(hi) << 32) | lo);
+	sched::Fiber* next = fiber->entry(fiber, fiber->entryContext);
+	setcontext(&next->context);
+}
+
+#elif BENCH_FIBER_WINDOWS
+
+static void WINAPI fiberStart(void* param)
+{
+	sched::Fiber* fiber = static_cast<sched::Fiber*>(param);
+	sched::Fiber* next = fiber->entry(fiber, fiber->entryContext);
+	SwitchToFiber(next->handle);
+}
+
+#endif
+
+sched::Fiber* NativeFiberFactory::fromCurrentThread()
+{
+	sched::Fiber* fiber = new sched::Fiber();
+
+#if BENCH_FIBER_WINDOWS
+	if (IsThreadAFiber())
+	{
+		fiber->handle = GetCurrentFiber();
+	}
+	else
+	{
+		fiber->handle = ConvertThreadToFiber(nullptr);
+		fiber->convertedThread = true;
+	}
+#endif
+
+	return fiber;
+}
+
+void NativeFiberFactory::releaseCurrentThread(sched::Fiber* fiber)
+{
+#if BENCH_FIBER_WINDOWS
+	if (fiber->convertedThread)
+	{
+		ConvertFiberToThread();
+	}
+#endif
+
+	delete fiber;
+}
+
+sched::Fiber* NativeFiberFactory::create(sched::FiberEntry entry, void* context, int stackSize)
+{
+	sched::Fiber* fiber = new sched::Fiber();
+	fiber->entry = entry;
+	fiber->entryContext = context;
+	fiber->stackSize = static_cast<size_t>(stackSize ? stackSize : defaultStackSize);
+
+#if BENCH_FIBER_WINDOWS
+	fiber->handle = CreateFiber(fiber->stackSize, fiberStart, fiber);
+#else
+	fiber->stack = mmap(nullptr, fiber->stackSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+#	if BENCH_FIBER_X64
+	// initial frame consumed by benchFiberSwitch. Returns into
+	// benchFiberTrampoline with a 16 byte aligned stack and the fiber in rbx
+	uint64_t* top = reinterpret_cast<uint64_t*>(static_cast<char*>(fiber->stack) + fiber->stackSize);
+	uint64_t* sp = top - 3;
+	*sp = reinterpret_cast<uint64_t>(&benchFiberTrampoline);
+	*--sp = 0; // rbp
+	*--sp = reinterpret_cast<uint64_t>(fiber); // rbx
+	*--sp = 0; // r12
+	*--sp = 0; // r13
+	*--sp = 0; // r14
+	*--sp = 0; // r15
+	*--sp = 0x037f00001f80ull; // default fpu control word : mxcsr
+	fiber->sp = sp;
+#	else
+	getcontext(&fiber->context);
+	fiber->context.uc_stack.ss_sp = fiber->stack;
+	fiber->context.uc_stack.ss_size = fiber->stackSize;
+	fiber->context.uc_link = nullptr;
+
+	const uintptr_t ptr = reinterpret_cast<uintptr_t>(fiber);
+	makecontext(&fiber->context, reinterpret_cast<void(*)()>(fiberStart), 2, static_cast<unsigned int>(ptr), static_cast<unsigned int>(ptr >> 32));
+#	endif
+#endif
+
+	return fiber;
+}
+
+void NativeFiberFactory::release(sched::Fiber* fiber)
+{
+#if BENCH_FIBER_WINDOWS
+	DeleteFiber(fiber->handle);
+#else
+	munmap(fiber->stack, fiber->stackSize);
+#endif
+
+	delete fiber;
+}
+
+void NativeFiberFactory::switchTo(sched::Fiber* from, sched::Fiber* to)
+{
+#if BENCH_FIBER_WINDOWS
+	(void)from;
+	SwitchToFiber(to->handle);
+#elif BENCH_FIBER_X64
+	benchFiberSwitch(&from->sp, to->sp);
+#else
+	swapcontext(&from->context, &to->context);
+#endif
+}
+
+bool NativeFiberFactory::stackBounds(sched::Fiber* fiber, void** base, size_t* size)
+{
+#if BENCH_FIBER_WINDOWS
+	// CreateFiber does not expose its stack
+	(void)fiber;
+	(void)base;
+	(void)size;
+	return false;
+#else
+	*base = fiber->stack;
+	*size = fiber->stackSize;
+	return true;
+#endif
+}
@@ -0,0 +1,51 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+#include "sched/fiber.h"
+
+namespace bench {
+
+	// Fiber factory used by the benchmarks. Uses a hand written context
+	// switch on x86-64, native fibers on Windows and ucontext elsewhere
+	struct NativeFiberFactory : sched::FiberFactory
+	{
+		explicit NativeFiberFactory(int defaultStackSize = 64 * 1024)
+			: defaultStackSize(defaultStackSize)
+		{
+		}
+
+		virtual sched::Fiber* fromCurrentThread() override;
+		virtual void releaseCurrentThread(sched::Fiber* fiber) override;
+		virtual sched::Fiber* create(sched::FiberEntry entry, void* context, int stackSize) override;
+		virtual void release(sched::Fiber* fiber) override;
+		virtual void switchTo(sched::Fiber* from, sched::Fiber* to) override;
+		virtual bool stackBounds(sched::Fiber* fiber, void** base, size_t* size) override;
+
+		int defaultStackSize;
+	};
+
+} // namespace bench
@@ -0,0 +1,143 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "harness.h"
+#include "sched/scheduler.h"
+
+using namespace bench;
+
+typedef std::chrono::high_resolution_clock bench_clock;
+
+NativeFiberFactory bench::g_factory;
+
+static void report(const char* name, int nthreads, uint64_t ops, bench_clock::duration elapsed)
+{
+	const double seconds = std::chrono::duration<double>(elapsed).count();
+	const double nsPerOp = ops ? std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(ops) : 0.0;
+	std::printf("%s,%d,%llu,%.6f,%.2f\n", name, nthreads, static_cast<unsigned long long>(ops), seconds, nsPerOp);
+	std::fflush(stdout);
+}
+
+static void usage(const char* argv0, const Benchmark* benchmarks, size_t count)
+{
+	std::fprintf(stderr, "usage: %s [--threads N] [--scale N] [benchmark...]\n", argv0);
+	std::fprintf(stderr, "benchmarks:");
+	for (size_t ii = 0; ii != count; ++ii)
+	{
+		std::fprintf(stderr, " %s", benchmarks[ii].name);
+	}
+	std::fprintf(stderr, "\n");
+}
+
+int bench::runBenchmarks(int argc, char** argv, const Benchmark* benchmarks, size_t count)
+{
+	int maxThreads = static_cast<int>(std::thread::hardware_concurrency());
+	uint64_t scale = 1;
+	std::vector<const char*> filters;
+
+	for (int ii = 1; ii < argc; ++ii)
+	{
+		if (0 == std::strcmp(argv[ii], "--threads") && ii + 1 < argc)
+		{
+			maxThreads = std::atoi(argv[++ii]);
+		}
+		else if (0 == std::strcmp(argv[ii], "--scale") && ii + 1 < argc)
+		{
+			scale = std::strtoull(argv[++ii], nullptr, 10);
+		}
+		else if (argv[ii][0] == '-')
+		{
+			usage(argv[0], benchmarks, count);
+			return 1;
+		}
+		else
+		{
+			filters.push_back(argv[ii]);
+		}
+	}
+
+	if (maxThreads < 1)
+	{
+		maxThreads = 1;
+	}
+
+	// sweep 1, 2, 4, ... threads, always ending with maxThreads
+	std::vector<int> threadCounts;
+	for (int n = 1; n < maxThreads; n *= 2)
+	{
+		threadCounts.push_back(n);
+	}
+	threadCounts.push_back(maxThreads);
+
+	std::printf("benchmark,threads,operations,seconds,ns_per_op\n");
+
+	for (size_t ii = 0; ii != count; ++ii)
+	{
+		const Benchmark& b = benchmarks[ii];
+		if (!filters.empty())
+		{
+			bool selected = false;
+			for (const char* filter : filters)
+			{
+				selected = selected || 0 == std::strcmp(filter, b.name);
+			}
+
+			if (!selected)
+			{
+				continue;
+			}
+		}
+
+		if (!b.threaded)
+		{
+			const auto start = bench_clock::now();
+			const uint64_t ops = b.run(nullptr, 1, scale);
+			report(b.name, 1, ops, bench_clock::now() - start);
+			continue;
+		}
+
+		for (int nthreads : threadCounts)
+		{
+			uint64_t ops = 0;
+			bench_clock::duration elapsed;
+			sched::runFunction(&g_factory, nthreads, [&](sched::Scheduler* scheduler) {
+				const auto start = bench_clock::now();
+				ops = b.run(scheduler, nthreads, scale);
+				elapsed = bench_clock::now() - start;
+			});
+
+			report(b.name, nthreads, ops, elapsed);
+		}
+	}
+
+	return 0;
+}
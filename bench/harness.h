@@ -0,0 +1,58 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "fiber.h"
+
+namespace sched {
+	struct Scheduler;
+}
+
+namespace bench {
+
+	struct Benchmark
+	{
+		const char* name;
+
+		// false for benchmarks that do not use a scheduler. These only run
+		// with a single thread
+		bool threaded;
+
+		// executes the benchmark, returning the number of operations
+		// performed. Threaded benchmarks run inside a task
+		uint64_t (*run)(sched::Scheduler* scheduler, int nthreads, uint64_t scale);
+	};
+
+	// fiber factory shared by all benchmarks
+	extern NativeFiberFactory g_factory;
+
+	// parse the command line and run the selected benchmarks, writing CSV
+	// results to stdout
+	int runBenchmarks(int argc, char** argv, const Benchmark* benchmarks, size_t count);
+
+} // namespace bench
@@ -0,0 +1,454 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+#include "harness.h"
+#include "sched/algorithm.h"
+#include "sched/parallel.h"
+#include "sched/scheduler.h"
+#include "sched/sema.h"
+#include "sched/waitgroup.h"
+
+using namespace bench;
+
+static void verify(bool condition, const char* benchmark)
+{
+	if (!condition)
+	{
+		std::fprintf(stderr, "%s: incorrect result\n", benchmark);
+		std::abort();
+	}
+}
+
+static uint64_t splitmix64(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+// skynet: a 10-ary tree of tasks, one million leaves. Each task sums the
+// ordinals reported by its children
+static const uint64_t c_skynetLeaves = 1000000;
+
+// skynet keeps most of its 1.1M tasks alive at once
+static const int c_skynetStackSize = 16 * 1024;
+
+static void skynet(uint64_t* result, uint64_t num, uint64_t size)
+{
+	if (size == 1)
+	{
+		*result = num;
+		return;
+	}
+
+	const uint64_t childSize = size / 10;
+	uint64_t results[10];
+
+	sched::TaskOptions options;
+	options.stackSize = c_skynetStackSize;
+
+	sched::WaitGroup wg;
+	wg.add(10);
+	for (uint64_t ii = 0; ii != 10; ++ii)
+	{
+		uint64_t* childResult = &results[ii];
+		const uint64_t childNum = num + ii * childSize;
+		sched::spawn([&wg, childResult, childNum, childSize]() {
+			skynet(childResult, childNum, childSize);
+			wg.done();
+		}, options);
+	}
+
+	wg.wait();
+
+	uint64_t sum = 0;
+	for (uint64_t r : results)
+	{
+		sum += r;
+	}
+	*result = sum;
+}
+
+static uint64_t benchSkynet(sched::Scheduler*, int, uint64_t scale)
+{
+	uint64_t tasks = 0;
+	for (uint64_t ii = 0; ii != scale; ++ii)
+	{
+		uint64_t result;
+		skynet(&result, 0, c_skynetLeaves);
+		verify(result == c_skynetLeaves * (c_skynetLeaves - 1) / 2, "skynet");
+
+		for (uint64_t level = 10; level <= c_skynetLeaves; level *= 10)
+		{
+			tasks += level;
+		}
+	}
+
+	return tasks;
+}
+
+// recursive fibonacci: fib(n-1) in a new task, fib(n-2) inline
+static const int c_fibN = 25;
+
+static uint64_t fib(int n)
+{
+	if (n < 2)
+	{
+		return static_cast<uint64_t>(n);
+	}
+
+	uint64_t a;
+	sched::WaitGroup wg;
+	wg.add(1);
+	sched::spawn([&a, &wg, n]() {
+		a = fib(n - 1);
+		wg.done();
+	});
+
+	const uint64_t b = fib(n - 2);
+	wg.wait();
+	return a + b;
+}
+
+static uint64_t benchFib(sched::Scheduler*, int, uint64_t scale)
+{
+	// a task is spawned for each call with n >= 2; there are fib(n+1)-1 of them
+	uint64_t expected[c_fibN + 2] = {0, 1};
+	for (int ii = 2; ii != c_fibN + 2; ++ii)
+	{
+		expected[ii] = expected[ii - 1] + expected[ii - 2];
+	}
+
+	for (uint64_t ii = 0; ii != scale; ++ii)
+	{
+		verify(fib(c_fibN) == expected[c_fibN], "fib");
+	}
+
+	return (expected[c_fibN + 1] - 1) * scale;
+}
+
+// parallel quicksort: sort the left partition in a new task, the right
+// partition inline
+static const size_t c_quicksortElements = 10000000;
+static const size_t c_quicksortCutoff = 4096;
+
+static void quicksort(uint32_t* first, uint32_t* last)
+{
+	sched::WaitGroup wg;
+	while (static_cast<size_t>(last - first) > c_quicksortCutoff)
+	{
+		// median of three pivot
+		uint32_t* mid = first + (last - first) / 2;
+		const uint32_t pivot = std::max(std::min(*first, *mid), std::min(std::max(*first, *mid), *(last - 1)));
+
+		uint32_t* lo = first;
+		uint32_t* hi = last - 1;
+		for (;;)
+		{
+			while (*lo < pivot)
+			{
+				++lo;
+			}
+			while (*hi > pivot)
+			{
+				--hi;
+			}
+			if (lo >= hi)
+			{
+				break;
+			}
+			std::swap(*lo++, *hi--);
+		}
+
+		uint32_t* const split = hi + 1;
+		wg.add(1);
+		sched::spawn([&wg, first, split]() {
+			quicksort(first, split);
+			wg.done();
+		});
+
+		first = split;
+	}
+
+	std::sort(first, last);
+	wg.wait();
+}
+
+static uint64_t benchQuicksort(sched::Scheduler*, int, uint64_t scale)
+{
+	const size_t n = c_quicksortElements * scale;
+	std::vector<uint32_t> data(n);
+
+	uint64_t state = 0;
+	for (uint32_t& v : data)
+	{
+		state = splitmix64(state);
+		v = static_cast<uint32_t>(state);
+	}
+
+	quicksort(data.data(), data.data() + n);
+	verify(std::is_sorted(data.begin(), data.end()), "quicksort");
+
+	return n;
+}
+
+// parallelSort over the same input as quicksort
+static uint64_t benchParallelSort(sched::Scheduler*, int, uint64_t scale)
+{
+	const size_t n = c_quicksortElements * scale;
+	std::vector<uint32_t> data(n);
+
+	uint64_t state = 0;
+	for (uint32_t& v : data)
+	{
+		state = splitmix64(state);
+		v = static_cast<uint32_t>(state);
+	}
+
+	sched::parallelSort(data.begin(), data.end());
+	verify(std::is_sorted(data.begin(), data.end()), "parallel_sort");
+
+	return n;
+}
+
+// unbalanced tree search: a binomial tree (UTS T3 shape) where the root has
+// c_utsRootChildren children and every other node has c_utsChildren
+// children with probability c_utsChildProbability. UTS derives child
+// states with SHA-1; splitmix64 is used here instead, so node counts do not
+// match the reference trees
+static const int c_utsRootChildren = 2000;
+static const int c_utsChildren = 8;
+static const double c_utsChildProbability = 0.124875;
+
+namespace {
+
+	struct UtsSearch
+	{
+		sched::WaitGroup wg;
+		std::atomic<uint64_t> nodes = ATOMIC_VAR_INIT(0);
+	};
+
+} // namespace `anonymous'
+
+static void utsVisit(UtsSearch* search, uint64_t state, bool root)
+{
+	search->nodes.fetch_add(1, std::memory_order_relaxed);
+
+	int nchildren = c_utsChildren;
+	if (root)
+	{
+		nchildren = c_utsRootChildren;
+	}
+	else if (static_cast<double>(state >> 11) * (1.0 / 9007199254740992.0) >= c_utsChildProbability)
+	{
+		nchildren = 0;
+	}
+
+	search->wg.add(nchildren);
+	for (int ii = 0; ii != nchildren; ++ii)
+	{
+		const uint64_t childState = splitmix64(state ^ static_cast<uint64_t>(ii + 1) * 0xd1342543de82ef95ull);
+		sched::spawn([search, childState]() {
+			utsVisit(search, childState, false);
+			search->wg.done();
+		});
+	}
+}
+
+static uint64_t benchUts(sched::Scheduler*, int, uint64_t scale)
+{
+	uint64_t nodes = 0;
+	for (uint64_t ii = 0; ii != scale; ++ii)
+	{
+		UtsSearch search;
+		utsVisit(&search, splitmix64(ii), true);
+		search.wg.wait();
+
+		nodes += search.nodes.load();
+	}
+
+	return nodes;
+}
+
+// parallelReduce over a cheap per-element body: sum of splitmix64(i)
+static const int64_t c_parallelReduceElements = 50000000;
+
+static uint64_t benchParallelReduce(sched::Scheduler*, int, uint64_t scale)
+{
+	const int64_t n = c_parallelReduceElements * static_cast<int64_t>(scale);
+
+	const uint64_t sum = sched::parallelReduce<uint64_t>(0, n, 0, 0, [](int64_t ii) {
+		return splitmix64(static_cast<uint64_t>(ii));
+	}, [](uint64_t a, uint64_t b) {
+		return a + b;
+	});
+
+	// the same sum again, serially, over a sample of the range
+	const int64_t sample = std::min<int64_t>(n, 1000000);
+	const uint64_t partial = sched::parallelReduce<uint64_t>(0, sample, 1, 0, [](int64_t ii) {
+		return splitmix64(static_cast<uint64_t>(ii));
+	}, [](uint64_t a, uint64_t b) {
+		return a + b;
+	});
+
+	uint64_t expected = 0;
+	for (int64_t ii = 0; ii != sample; ++ii)
+	{
+		expected += splitmix64(static_cast<uint64_t>(ii));
+	}
+
+	verify(partial == expected && (sample != n || sum == expected), "parallel_reduce");
+	return static_cast<uint64_t>(n);
+}
+
+// multi-tenant isolation: a tenant issues requests one at a time, each a
+// short task, while another tenant in its own TaskGroup optionally keeps a
+// deep backlog of CPU-bound tasks queued. Requests are sequential, so
+// ns_per_op is the request latency. Tasks aren't preempted, so with the
+// flood a request can wait out one flood task already running, but it
+// shouldn't grow with the depth of the backlog
+static const uint64_t c_tenantRequests = 2000;
+static const int c_tenantRequestWork = 256;
+static const int c_floodBacklog = 1024;
+static const int c_floodWork = 16384;
+
+static uint64_t spin(int rounds)
+{
+	uint64_t x = 0;
+	for (int ii = 0; ii != rounds; ++ii)
+	{
+		x = splitmix64(x);
+	}
+	return x;
+}
+
+static uint64_t tenantLatency(sched::Scheduler* scheduler, uint64_t scale, bool flood)
+{
+	sched::TaskGroup* quiet = sched::createTaskGroup(scheduler, sched::TaskGroupOptions());
+	sched::TaskGroup* noisy = sched::createTaskGroup(scheduler, sched::TaskGroupOptions());
+
+	std::atomic<bool> stop(false);
+	std::atomic<int> backlog(0);
+	sched::WaitGroup wg;
+
+	if (flood)
+	{
+		sched::TaskOptions options;
+		options.group = noisy;
+
+		wg.add(1);
+		sched::spawn([&stop, &backlog, &wg]() {
+			while (!stop.load())
+			{
+				if (backlog.load() >= c_floodBacklog)
+				{
+					sched::yield();
+					continue;
+				}
+
+				backlog.fetch_add(1);
+				wg.add(1);
+				sched::spawn([&stop, &backlog, &wg]() {
+					if (!stop.load())
+					{
+						verify(0 != spin(c_floodWork), "tenant_latency_flood");
+					}
+
+					backlog.fetch_sub(1);
+					wg.done();
+				});
+			}
+
+			wg.done();
+		}, options);
+	}
+
+	const uint64_t requests = c_tenantRequests * scale;
+	std::atomic<uint64_t> completed(0);
+
+	sched::TaskOptions options;
+	options.group = quiet;
+
+	wg.add(1);
+	sched::spawn([requests, &completed, &stop, &wg]() {
+		for (uint64_t ii = 0; ii != requests; ++ii)
+		{
+			sched::Sema done(0);
+			sched::spawn([&done, &completed]() {
+				if (0 != spin(c_tenantRequestWork))
+				{
+					completed.fetch_add(1);
+				}
+				done.release();
+			});
+			done.acquire();
+		}
+
+		stop.store(true);
+		wg.done();
+	}, options);
+
+	wg.wait();
+	verify(completed.load() == requests, flood ? "tenant_latency_flood" : "tenant_latency");
+
+	sched::destroyTaskGroup(quiet);
+	sched::destroyTaskGroup(noisy);
+	return requests;
+}
+
+static uint64_t benchTenantLatency(sched::Scheduler* scheduler, int, uint64_t scale)
+{
+	return tenantLatency(scheduler, scale, false);
+}
+
+static uint64_t benchTenantLatencyFlood(sched::Scheduler* scheduler, int, uint64_t scale)
+{
+	return tenantLatency(scheduler, scale, true);
+}
+
+static const Benchmark c_benchmarks[] = {
+	{"skynet", true, benchSkynet},
+	{"fib", true, benchFib},
+	{"quicksort", true, benchQuicksort},
+	{"parallel_sort", true, benchParallelSort},
+	{"uts", true, benchUts},
+	{"parallel_reduce", true, benchParallelReduce},
+	{"tenant_latency", true, benchTenantLatency},
+	{"tenant_latency_flood", true, benchTenantLatencyFlood},
+};
+
+int main(int argc, char** argv)
+{
+	return runBenchmarks(argc, argv, c_benchmarks, sizeof(c_benchmarks) / sizeof(c_benchmarks[0]));
+}
@@ -0,0 +1,322 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "harness.h"
+#include "sched/fiber.h"
+#include "sched/scheduler.h"
+#include "sched/sema.h"
+#include "sched/timer.h"
+#include "sched/waitgroup.h"
+
+using namespace bench;
+
+// raw FiberFactory::switchTo between two fibers
+static uint64_t benchSwitchTo(sched::Scheduler*, int, uint64_t scale)
+{
+	struct Context
+	{
+		sched::FiberFactory* factory;
+		sched::Fiber* caller;
+	};
+
+	const uint64_t n = 1000000 * scale;
+
+	Context ctx;
+	ctx.factory = &g_factory;
+	ctx.caller = g_factory.fromCurrentThread();
+
+	sched::Fiber* fiber = g_factory.create([](sched::Fiber* self, void* context) -> sched::Fiber* {
+		Context* ctx = static_cast<Context*>(context);
+		for (;;)
+		{
+			ctx->factory->switchTo(self, ctx->caller);
+		}
+	}, &ctx, 0);
+
+	for (uint64_t ii = 0; ii != n; ++ii)
+	{
+		g_factory.switchTo(ctx.caller, fiber);
+	}
+
+	g_factory.release(fiber);
+	g_factory.releaseCurrentThread(ctx.caller);
+
+	// each iteration switches to the fiber and back
+	return n * 2;
+}
+
+// spawn a task that does nothing and wait for it to complete
+static uint64_t benchSpawn(sched::Scheduler*, int, uint64_t scale)
+{
+	const uint64_t n = 100000 * scale;
+
+	sched::WaitGroup wg;
+	wg.add(static_cast<int>(n));
+	for (uint64_t ii = 0; ii != n; ++ii)
+	{
+		sched::spawn([&wg]() {
+			wg.done();
+		});
+	}
+
+	wg.wait();
+	return n;
+}
+
+// spawnMany batches of 1000 tasks that do nothing
+static uint64_t benchSpawnMany(sched::Scheduler*, int, uint64_t scale)
+{
+	const int batch = 1000;
+	const uint64_t rounds = 100 * scale;
+
+	for (uint64_t ii = 0; ii != rounds; ++ii)
+	{
+		sched::WaitGroup wg;
+		wg.add(batch);
+		sched::spawnMany(batch, [&wg](int) {
+			wg.done();
+		});
+
+		wg.wait();
+	}
+
+	return rounds * batch;
+}
+
+// one task per thread, each yielding in a loop
+static uint64_t benchYield(sched::Scheduler*, int nthreads, uint64_t scale)
+{
+	const uint64_t n = 100000 * scale;
+
+	sched::WaitGroup wg;
+	wg.add(nthreads);
+	for (int ii = 0; ii != nthreads; ++ii)
+	{
+		sched::spawn([&wg, n]() {
+			for (uint64_t jj = 0; jj != n; ++jj)
+			{
+				sched::yield();
+			}
+			wg.done();
+		});
+	}
+
+	wg.wait();
+	return n * static_cast<uint64_t>(nthreads);
+}
+
+// two tasks passing control back and forth through a pair of semaphores
+static uint64_t benchSemaPingPong(sched::Scheduler*, int, uint64_t scale)
+{
+	const uint64_t n = 100000 * scale;
+
+	sched::Sema ping;
+	sched::Sema pong;
+	sched::WaitGroup wg;
+	wg.add(2);
+
+	sched::spawn([&]() {
+		for (uint64_t ii = 0; ii != n; ++ii)
+		{
+			ping.release();
+			pong.acquire();
+		}
+		wg.done();
+	});
+
+	sched::spawn([&]() {
+		for (uint64_t ii = 0; ii != n; ++ii)
+		{
+			ping.acquire();
+			pong.release();
+		}
+		wg.done();
+	});
+
+	wg.wait();
+	return n;
+}
+
+// acquire/release pairs on a semaphore nobody else is using
+static uint64_t benchSemaUncontended(sched::Scheduler*, int, uint64_t scale)
+{
+	const uint64_t n = 1000000 * scale;
+
+	sched::Sema sema(1);
+	for (uint64_t ii = 0; ii != n; ++ii)
+	{
+		sema.acquire();
+		sema.release();
+	}
+
+	return n;
+}
+
+// several tasks per thread acquiring the same semaphore. The holder yields
+// before releasing it, so the others queue on it and are woken in turn
+static uint64_t benchSemaContended(sched::Scheduler*, int nthreads, uint64_t scale)
+{
+	const uint64_t n = 10000 * scale;
+	const int ntasks = nthreads * 4;
+
+	sched::Sema sema(1);
+	sched::WaitGroup wg;
+	wg.add(ntasks);
+	for (int ii = 0; ii != ntasks; ++ii)
+	{
+		sched::spawn([&sema, &wg, n]() {
+			for (uint64_t jj = 0; jj != n; ++jj)
+			{
+				sema.acquire();
+				sched::yield();
+				sema.release();
+			}
+			wg.done();
+		});
+	}
+
+	wg.wait();
+	return n * static_cast<uint64_t>(ntasks);
+}
+
+static uint64_t fanOutFanIn(int ntasks, uint64_t rounds)
+{
+	for (uint64_t ii = 0; ii != rounds; ++ii)
+	{
+		sched::WaitGroup wg;
+		wg.add(ntasks);
+		for (int jj = 0; jj != ntasks; ++jj)
+		{
+			sched::spawn([&wg]() {
+				wg.done();
+			});
+		}
+
+		wg.wait();
+	}
+
+	return static_cast<uint64_t>(ntasks) * rounds;
+}
+
+static uint64_t benchWaitGroup1k(sched::Scheduler*, int, uint64_t scale)
+{
+	return fanOutFanIn(1000, 100 * scale);
+}
+
+static uint64_t benchWaitGroup100k(sched::Scheduler*, int, uint64_t scale)
+{
+	return fanOutFanIn(100000, scale);
+}
+
+// many tasks repeatedly sleeping for a millisecond
+static uint64_t benchSleepChurn(sched::Scheduler*, int, uint64_t scale)
+{
+	const int ntasks = 1000;
+	const uint64_t n = 10 * scale;
+
+	sched::WaitGroup wg;
+	wg.add(ntasks);
+	for (int ii = 0; ii != ntasks; ++ii)
+	{
+		sched::spawn([&wg, n]() {
+			for (uint64_t jj = 0; jj != n; ++jj)
+			{
+				sched::sleepMS(1);
+			}
+			wg.done();
+		});
+	}
+
+	wg.wait();
+	return n * ntasks;
+}
+
+// threads outside the scheduler releasing semaphores that tasks wait on
+static uint64_t benchForeignWake(sched::Scheduler*, int, uint64_t scale)
+{
+	const int ntasks = 1000;
+	const int nforeign = 4;
+	const uint64_t n = 100 * scale;
+
+	std::vector<sched::Sema> semas(ntasks);
+	sched::WaitGroup wg;
+	wg.add(ntasks);
+	for (int ii = 0; ii != ntasks; ++ii)
+	{
+		sched::Sema* sema = &semas[ii];
+		sched::spawn([sema, &wg, n]() {
+			for (uint64_t jj = 0; jj != n; ++jj)
+			{
+				sema->acquire();
+			}
+			wg.done();
+		});
+	}
+
+	std::vector<std::thread> foreign;
+	for (int ii = 0; ii != nforeign; ++ii)
+	{
+		foreign.emplace_back([&semas, ii, n]() {
+			for (uint64_t jj = 0; jj != n; ++jj)
+			{
+				for (int kk = ii; kk < ntasks; kk += nforeign)
+				{
+					semas[kk].release();
+				}
+			}
+		});
+	}
+
+	wg.wait();
+	for (std::thread& t : foreign)
+	{
+		t.join();
+	}
+
+	return n * ntasks;
+}
+
+static const Benchmark c_benchmarks[] = {
+	{"switch_to", false, benchSwitchTo},
+	{"spawn", true, benchSpawn},
+	{"spawn_many", true, benchSpawnMany},
+	{"yield", true, benchYield},
+	{"sema_ping_pong", true, benchSemaPingPong},
+	{"sema_uncontended", true, benchSemaUncontended},
+	{"sema_contended", true, benchSemaContended},
+	{"waitgroup_1k", true, benchWaitGroup1k},
+	{"waitgroup_100k", true, benchWaitGroup100k},
+	{"sleep_churn", true, benchSleepChurn},
+	{"foreign_wake", true, benchForeignWake},
+};
+
+int main(int argc, char** argv)
+{
+	return runBenchmarks(argc, argv, c_benchmarks, sizeof(c_benchmarks) / sizeof(c_benchmarks[0]));
+}
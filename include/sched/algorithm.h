@@ -0,0 +1,355 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <utility>
+#include <vector>
+#include "sched/parallel.h"
+
+namespace sched {
+
+	namespace detail {
+
+		// below this many elements the std algorithm runs serially
+		static const int64_t c_algorithmSerialElements = 16384;
+
+		// independent blocks per worker for block-wise passes
+		static const int64_t c_algorithmBlocksPerWorker = 4;
+
+		// each merge job produces this many elements, so its inputs and
+		// output stay in cache
+		static const int64_t c_mergeChunkElements = 32768;
+
+		// number of blocks to split n elements into, or 0 to run serially
+		inline int64_t algorithmBlocks(int64_t n)
+		{
+			const int64_t workers = parallelWorkers();
+			if (workers <= 1 || n < c_algorithmSerialElements)
+			{
+				return 0;
+			}
+
+			return std::max<int64_t>(1, std::min(workers * c_algorithmBlocksPerWorker, n / (c_algorithmSerialElements / 4)));
+		}
+
+		// elements of a (length na) among the first diag elements of the
+		// stable merge of a and b
+		template<typename ItA, typename ItB, typename Compare>
+		int64_t mergePath(ItA a, int64_t na, ItB b, int64_t nb, int64_t diag, Compare& comp)
+		{
+			int64_t lo = std::max<int64_t>(0, diag - nb);
+			int64_t hi = std::min(diag, na);
+			while (lo < hi)
+			{
+				const int64_t mid = lo + (hi - lo) / 2;
+				if (!comp(b[diag - 1 - mid], a[mid]))
+				{
+					lo = mid + 1;
+				}
+				else
+				{
+					hi = mid;
+				}
+			}
+
+			return lo;
+		}
+
+		// merge adjacent pairs of sorted runs from src into dst. bounds holds
+		// the run boundaries and is updated for the merged runs
+		template<typename Src, typename Dst, typename Compare>
+		void mergePass(Src src, Dst dst, std::vector<int64_t>* bounds, Compare& comp)
+		{
+			const std::vector<int64_t>& b = *bounds;
+			const int64_t nruns = static_cast<int64_t>(b.size()) - 1;
+
+			// one job per output chunk of each pair. Split points are found up
+			// front, since the merges move elements out of src
+			struct Chunk
+			{
+				int64_t begin;
+				int64_t middle;
+				int64_t diag0;
+				int64_t diag1;
+				int64_t split0;
+				int64_t split1;
+			};
+
+			std::vector<Chunk> chunks;
+			for (int64_t pair = 0; pair < nruns; pair += 2)
+			{
+				const int64_t begin = b[pair];
+				const int64_t middle = b[std::min(pair + 1, nruns)];
+				const int64_t end = b[std::min(pair + 2, nruns)];
+				const int64_t na = middle - begin;
+				const int64_t nb = end - middle;
+
+				int64_t split = 0;
+				for (int64_t diag = 0; diag < na + nb; diag += c_mergeChunkElements)
+				{
+					const int64_t next = std::min(na + nb, diag + c_mergeChunkElements);
+					const int64_t nextSplit = mergePath(src + begin, na, src + middle, nb, next, comp);
+					chunks.push_back(Chunk{begin, middle, diag, next, split, nextSplit});
+					split = nextSplit;
+				}
+			}
+
+			parallelFor(0, static_cast<int64_t>(chunks.size()), 1, [&](int64_t ii) {
+				const Chunk& c = chunks[ii];
+				std::merge(std::make_move_iterator(src + c.begin + c.split0), std::make_move_iterator(src + c.begin + c.split1),
+					std::make_move_iterator(src + c.middle + (c.diag0 - c.split0)), std::make_move_iterator(src + c.middle + (c.diag1 - c.split1)),
+					dst + c.begin + c.diag0, comp);
+			});
+
+			std::vector<int64_t> merged;
+			for (int64_t ii = 0; ii < nruns; ii += 2)
+			{
+				merged.push_back(b[ii]);
+			}
+			merged.push_back(b[nruns]);
+			bounds->swap(merged);
+		}
+
+	} // namespace detail
+
+	// Parallel versions of the std algorithms of the same name (random
+	// access iterators only). They run on the current scheduler's workers
+	// through parallelFor, so the same rules apply: functors must not
+	// suspend, and outside of a scheduler, with a single worker or for
+	// small inputs the std algorithm is called directly.
+
+	// Transform elements independently
+	template<typename InputIt, typename OutputIt, typename UnaryOp>
+	OutputIt parallelTransform(InputIt first, InputIt last, OutputIt dFirst, UnaryOp op)
+	{
+		const int64_t n = last - first;
+		parallelFor(0, n, 0, [&](int64_t ii) {
+			dFirst[ii] = op(first[ii]);
+		});
+
+		return dFirst + n;
+	}
+
+	template<typename InputIt1, typename InputIt2, typename OutputIt, typename BinaryOp>
+	OutputIt parallelTransform(InputIt1 first1, InputIt1 last1, InputIt2 first2, OutputIt dFirst, BinaryOp op)
+	{
+		const int64_t n = last1 - first1;
+		parallelFor(0, n, 0, [&](int64_t ii) {
+			dFirst[ii] = op(first1[ii], first2[ii]);
+		});
+
+		return dFirst + n;
+	}
+
+	// Inclusive prefix scan in three passes: block totals in parallel, a
+	// serial scan of the totals, then each block rescanned from its
+	// carry-in. op must be associative. dFirst may equal first
+	template<typename InputIt, typename OutputIt, typename BinaryOp>
+	OutputIt parallelInclusiveScan(InputIt first, InputIt last, OutputIt dFirst, BinaryOp op)
+	{
+		typedef typename std::iterator_traits<InputIt>::value_type T;
+
+		const int64_t n = last - first;
+		const int64_t nblocks = detail::algorithmBlocks(n);
+		if (nblocks <= 1)
+		{
+			return std::partial_sum(first, last, dFirst, op);
+		}
+
+		std::vector<T> totals(static_cast<size_t>(nblocks), first[0]);
+		parallelFor(0, nblocks, 1, [&](int64_t block) {
+			const int64_t begin = n * block / nblocks;
+			const int64_t end = n * (block + 1) / nblocks;
+
+			T total = first[begin];
+			for (int64_t ii = begin + 1; ii != end; ++ii)
+			{
+				total = op(total, first[ii]);
+			}
+			totals[block] = total;
+		});
+
+		// totals[block] becomes the carry into block + 1
+		for (int64_t block = 1; block < nblocks; ++block)
+		{
+			totals[block] = op(totals[block - 1], totals[block]);
+		}
+
+		parallelFor(0, nblocks, 1, [&](int64_t block) {
+			const int64_t begin = n * block / nblocks;
+			const int64_t end = n * (block + 1) / nblocks;
+
+			T value = (0 == block) ? T(first[begin]) : op(totals[block - 1], first[begin]);
+			dFirst[begin] = value;
+			for (int64_t ii = begin + 1; ii != end; ++ii)
+			{
+				value = op(value, first[ii]);
+				dFirst[ii] = value;
+			}
+		});
+
+		return dFirst + n;
+	}
+
+	template<typename InputIt, typename OutputIt>
+	OutputIt parallelInclusiveScan(InputIt first, InputIt last, OutputIt dFirst)
+	{
+		return parallelInclusiveScan(first, last, dFirst, std::plus<typename std::iterator_traits<InputIt>::value_type>());
+	}
+
+	// Merge sort: blocks are sorted independently, then merged pairwise.
+	// Each merge is cut along its merge path into fixed size output
+	// chunks, so every pass spreads evenly across workers however the
+	// data falls. Not stable, like std::sort
+	template<typename RandomIt, typename Compare>
+	void parallelSort(RandomIt first, RandomIt last, Compare comp)
+	{
+		typedef typename std::iterator_traits<RandomIt>::value_type T;
+
+		const int64_t n = last - first;
+		const int64_t nblocks = detail::algorithmBlocks(n);
+		if (nblocks <= 1)
+		{
+			std::sort(first, last, comp);
+			return;
+		}
+
+		std::vector<int64_t> bounds(static_cast<size_t>(nblocks) + 1);
+		for (int64_t block = 0; block <= nblocks; ++block)
+		{
+			bounds[block] = n * block / nblocks;
+		}
+
+		parallelFor(0, nblocks, 1, [&](int64_t block) {
+			std::sort(first + bounds[block], first + bounds[block + 1], comp);
+		});
+
+		// merge back and forth between the input and a scratch buffer
+		std::allocator<T> alloc;
+		T* buffer = alloc.allocate(static_cast<size_t>(n));
+		parallelFor(0, n, 0, [&](int64_t ii) {
+			new (buffer + ii) T(std::move(first[ii]));
+		});
+
+		bool inBuffer = true;
+		while (bounds.size() > 2)
+		{
+			if (inBuffer)
+			{
+				detail::mergePass(buffer, first, &bounds, comp);
+			}
+			else
+			{
+				detail::mergePass(first, buffer, &bounds, comp);
+			}
+
+			inBuffer = !inBuffer;
+		}
+
+		parallelFor(0, n, 0, [&](int64_t ii) {
+			if (inBuffer)
+			{
+				first[ii] = std::move(buffer[ii]);
+			}
+			buffer[ii].~T();
+		});
+
+		alloc.deallocate(buffer, static_cast<size_t>(n));
+	}
+
+	template<typename RandomIt>
+	void parallelSort(RandomIt first, RandomIt last)
+	{
+		parallelSort(first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>());
+	}
+
+	// Blocks are partitioned independently, then both halves of every
+	// block are moved to their final places through a scratch buffer.
+	// Returns the first element of the second group. Not stable, like
+	// std::partition
+	template<typename RandomIt, typename UnaryPredicate>
+	RandomIt parallelPartition(RandomIt first, RandomIt last, UnaryPredicate pred)
+	{
+		typedef typename std::iterator_traits<RandomIt>::value_type T;
+
+		const int64_t n = last - first;
+		const int64_t nblocks = detail::algorithmBlocks(n);
+		if (nblocks <= 1)
+		{
+			return std::partition(first, last, pred);
+		}
+
+		std::vector<int64_t> matches(static_cast<size_t>(nblocks));
+		parallelFor(0, nblocks, 1, [&](int64_t block) {
+			const int64_t begin = n * block / nblocks;
+			const int64_t end = n * (block + 1) / nblocks;
+			matches[block] = std::partition(first + begin, first + end, pred) - (first + begin);
+		});
+
+		// destinations of each block's matching and remaining elements
+		std::vector<int64_t> matchOffset(static_cast<size_t>(nblocks));
+		std::vector<int64_t> restOffset(static_cast<size_t>(nblocks));
+		int64_t nmatches = 0;
+		for (int64_t block = 0; block < nblocks; ++block)
+		{
+			matchOffset[block] = nmatches;
+			nmatches += matches[block];
+		}
+		for (int64_t block = 0, rest = nmatches; block < nblocks; ++block)
+		{
+			const int64_t size = n * (block + 1) / nblocks - n * block / nblocks;
+			restOffset[block] = rest;
+			rest += size - matches[block];
+		}
+
+		std::allocator<T> alloc;
+		T* buffer = alloc.allocate(static_cast<size_t>(n));
+		parallelFor(0, nblocks, 1, [&](int64_t block) {
+			const int64_t begin = n * block / nblocks;
+			const int64_t end = n * (block + 1) / nblocks;
+			const int64_t split = begin + matches[block];
+
+			std::uninitialized_copy(std::make_move_iterator(first + begin), std::make_move_iterator(first + split), buffer + matchOffset[block]);
+			std::uninitialized_copy(std::make_move_iterator(first + split), std::make_move_iterator(first + end), buffer + restOffset[block]);
+		});
+
+		parallelFor(0, n, 0, [&](int64_t ii) {
+			first[ii] = std::move(buffer[ii]);
+			buffer[ii].~T();
+		});
+
+		alloc.deallocate(buffer, static_cast<size_t>(n));
+		return first + nmatches;
+	}
+
+} // namespace sched
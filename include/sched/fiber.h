@@ -25,6 +25,7 @@
 */
 #pragma once
 
+#include <cstddef>
 #include "sched/config.h"
 
 namespace sched {
@@ -49,6 +50,17 @@ namespace sched {
 		// Switch execution to anther fiber. This function returns when control
 		// is returned to the calling fiber
 		virtual void switchTo(Fiber* from, Fiber* to) = 0;
+
+		// Get the stack memory of a fiber returned by create. Optional; the
+		// scheduler needs it to profile stack usage. Stacks are assumed to
+		// grow down from base + size
+		virtual bool stackBounds(Fiber* fiber, void** base, size_t* size)
+		{
+			(void)fiber;
+			(void)base;
+			(void)size;
+			return false;
+		}
 	};
 
 } // namespace sched
@@ -0,0 +1,49 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+#if !defined(_WIN32)
+
+#include <cstdint>
+#include <sys/types.h>
+
+namespace sched {
+
+	// Scheduler aware file operations. Regular files are always "ready" to
+	// the poller, so these run on the worker's io_uring when one can be
+	// created, or otherwise on a small pool of helper threads. Either way the calling
+	// task is suspended until the operation finishes and its worker keeps
+	// running other tasks. Reads of adjacent ranges of the same file that
+	// are queued together are merged into a single call. offset -1 uses
+	// the file position. Return values and errno match pread, pwrite and
+	// fsync. Outside of a task the system call is made directly.
+	ssize_t fileRead(int fd, void* buf, size_t count, int64_t offset);
+	ssize_t fileWrite(int fd, const void* buf, size_t count, int64_t offset);
+	int fsync(int fd);
+
+} // namespace sched
+
+#endif // !defined(_WIN32)
@@ -0,0 +1,77 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+#if defined(__linux__)
+
+#include <cstdint>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+namespace sched {
+
+	// Scheduler aware socket operations. The descriptor must be in
+	// non-blocking mode. When the operation would block, the calling task
+	// is suspended until the scheduler's poller reports the descriptor
+	// ready, leaving the worker thread free to run other tasks. Return
+	// values and errno match the underlying system calls.
+	ssize_t read(int fd, void* buf, size_t count);
+	ssize_t write(int fd, const void* buf, size_t count);
+
+	// Accepted sockets are created non-blocking
+	int accept(int fd, sockaddr* addr, socklen_t* addrlen);
+
+	int connect(int fd, const sockaddr* addr, socklen_t addrlen);
+
+	// Suspend the current task until fd is readable (writable). Every task
+	// waiting on the descriptor is woken, so this may return spuriously.
+	// Returns -1 with errno set, without waiting, if the descriptor can't
+	// be polled
+	int waitReadable(int fd);
+	int waitWritable(int fd);
+
+	// Close a descriptor used with the functions above, waking the tasks
+	// waiting on it. A descriptor closed some other way is picked up again
+	// when its number is reused, but its waiters are not woken
+	int close(int fd);
+
+	// Zero-copy transfers with the same semantics as the corresponding
+	// system calls. Non-blocking descriptors suspend the task when the
+	// transfer would block. Offsets are updated as by the system calls
+	ssize_t sendfile(int outFd, int inFd, int64_t* offset, size_t count);
+	ssize_t splice(int inFd, int64_t* inOffset, int outFd, int64_t* outOffset, size_t len);
+	ssize_t tee(int inFd, int outFd, size_t len);
+
+	// Copy up to count bytes from inFd to outFd without passing the data
+	// through user space, stopping early at end of input. Uses sendfile
+	// when inFd supports it, otherwise splices through a pipe taken from a
+	// shared pool. Returns the number of bytes copied, or -1 if an error
+	// occurred before anything was copied
+	ssize_t copyFd(int outFd, int inFd, int64_t* offset, size_t count);
+
+} // namespace sched
+
+#endif // defined(__linux__)
@@ -0,0 +1,160 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "sched/config.h"
+
+namespace sched {
+
+	namespace detail {
+
+		// type erased loop body. Each job covers one contiguous subrange,
+		// delivered as a run of consecutive chunks between beginJob and
+		// endJob
+		struct SCHED_NO_VTABLE ParallelBody
+		{
+			virtual void* beginJob(int64_t begin) = 0;
+			virtual void runChunk(void* job, int64_t begin, int64_t end) = 0;
+			virtual void endJob(void* job) = 0;
+		};
+
+		void parallelRun(int64_t begin, int64_t end, int64_t grain, ParallelBody* body);
+
+		// workers available to parallelRun (0 outside of a scheduler)
+		int parallelWorkers();
+
+	} // namespace detail
+
+	// Calls fn(i) for every i in [begin, end), spread across the workers
+	// of the current scheduler. The range is split lazily: a worker only
+	// hands off half of its remaining range when it has nothing queued for
+	// others to take, and checks again every grain iterations (grain <= 0
+	// picks one from the range size and worker count). Pieces run as
+	// stackless jobs rather than tasks, and the caller works on the range
+	// too, returning once every iteration has finished. fn must not
+	// suspend (no Sema, sleepMS, blocking I/O). Outside of a scheduler the
+	// loop runs on the calling thread.
+	template<typename Fn>
+	void parallelFor(int64_t begin, int64_t end, int64_t grain, Fn fn)
+	{
+		struct Body : detail::ParallelBody
+		{
+			Fn* fn;
+
+			void* beginJob(int64_t) override
+			{
+				return nullptr;
+			}
+
+			void runChunk(void*, int64_t begin, int64_t end) override
+			{
+				for (int64_t ii = begin; ii != end; ++ii)
+				{
+					(*fn)(ii);
+				}
+			}
+
+			void endJob(void*) override
+			{
+			}
+		};
+
+		Body body;
+		body.fn = &fn;
+		detail::parallelRun(begin, end, grain, &body);
+	}
+
+	// Folds map(i) for every i in [begin, end) with combine, split across
+	// workers like parallelFor. Each piece is folded from identity and
+	// the pieces are combined in index order, so combine needs to be
+	// associative but not commutative.
+	template<typename T, typename Map, typename Combine>
+	T parallelReduce(int64_t begin, int64_t end, int64_t grain, const T& identity, Map map, Combine combine)
+	{
+		struct Partial
+		{
+			int64_t begin;
+			T value;
+		};
+
+		struct Body : detail::ParallelBody
+		{
+			const T* identity;
+			Map* map;
+			Combine* combine;
+
+			std::mutex lock;
+			std::vector<Partial> partials;
+
+			void* beginJob(int64_t begin) override
+			{
+				return new Partial{begin, *identity};
+			}
+
+			void runChunk(void* job, int64_t begin, int64_t end) override
+			{
+				Partial* p = static_cast<Partial*>(job);
+				for (int64_t ii = begin; ii != end; ++ii)
+				{
+					p->value = (*combine)(p->value, (*map)(ii));
+				}
+			}
+
+			void endJob(void* job) override
+			{
+				Partial* p = static_cast<Partial*>(job);
+				{
+					std::unique_lock<std::mutex> lock(this->lock);
+					partials.push_back(*p);
+				}
+				delete(p);
+			}
+		};
+
+		Body body;
+		body.identity = &identity;
+		body.map = &map;
+		body.combine = &combine;
+		detail::parallelRun(begin, end, grain, &body);
+
+		std::sort(body.partials.begin(), body.partials.end(), [](const Partial& a, const Partial& b) {
+			return a.begin < b.begin;
+		});
+
+		T result = identity;
+		for (const Partial& p : body.partials)
+		{
+			result = combine(result, p.value);
+		}
+
+		return result;
+	}
+
+} // namespace sched
@@ -25,6 +25,9 @@
 */
 #pragma once
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include "sched/config.h"
 
@@ -33,6 +36,7 @@ namespace sched {
 	struct FiberFactory;
 	struct Scheduler;
 	struct Task;
+	struct TaskGroup;
 
 	// Controlls lifetime of a scheduler thread
 	struct SCHED_NO_VTABLE RunContext
@@ -40,30 +44,258 @@ namespace sched {
 		virtual bool running() const = 0;
 	};
 
+	// Optional scheduler behavior
+	struct SchedulerOptions
+	{
+		// Keep a registry of all live tasks so they can be enumerated with
+		// dumpTasks
+		bool trackTasks = false;
+
+		// Paint task stacks when they are created and measure how much was
+		// used when they exit, aggregated by task name. Requires
+		// FiberFactory::stackBounds. Painting commits the whole stack
+		bool profileStacks = false;
+
+		// Size the stacks of tasks spawned with stackSize 0 from the usage
+		// observed for tasks of the same name. A sample of tasks keeps
+		// running with the default stack so usage continues to be profiled
+		bool adaptiveStacks = false;
+
+		// Simulation mode for reproducible runs. runFunction uses a single
+		// thread, runnable tasks are dispatched in a pseudo-random order
+		// derived from seed, and sleepMS uses a virtual clock that jumps to
+		// the next timer whenever no task is runnable
+		bool deterministic = false;
+		uint64_t seed = 0;
+
+		// Operations a task may complete on Sema, WaitGroup and socket or
+		// pipe I/O without blocking before the next one yields to other
+		// tasks. Bounds how long a task looping over ready primitives holds
+		// its worker. 0 disables
+		int coopBudget = 128;
+
+		// Linux only. A monitor thread signals (SIGURG) workers whose task
+		// has run for longer than this many milliseconds. A task inside a
+		// PreemptibleScope is requeued immediately; any other task yields
+		// at its next sched primitive. A SIGURG handler installed before
+		// the scheduler still receives every other SIGURG, and is restored
+		// once no scheduler preempts. Ignored by deterministic schedulers.
+		// 0 disables
+		int preemptSliceMS = 0;
+
+		// Pin each worker thread to its own CPU, filling one NUMA node
+		// before the next. Workers then prefer runnable tasks that last ran
+		// on their node, and steal jobs from their own node first. The
+		// thread calling run is restored to its previous CPUs on return
+		bool pinWorkers = false;
+
+		// Elastic workers. While growBacklog or more tasks are waiting to
+		// run and no worker is idle, further worker threads are started,
+		// one at a time, up to maxWorkers in total. They exit after
+		// workerIdleMS without work, or once the RunContext of every
+		// thread in run has stopped; threads that called run never
+		// retire. Ignored by deterministic schedulers. 0 disables
+		int maxWorkers = 0;
+		int growBacklog = 16;
+		int workerIdleMS = 1000;
+	};
+
+	// Order in which runnable tasks are dispatched. Each level has its own
+	// queue and higher levels run first. A waiting lower level is aged ahead
+	// after being passed over repeatedly, so it is never starved
+	enum class Priority
+	{
+		High,
+		Normal,
+		Background,
+	};
+
+	// Optional task parameters
+	struct TaskOptions
+	{
+		// Name reported by dumpTasks. Not copied; must outlive the task
+		const char* name = nullptr;
+
+		// Stack size passed to FiberFactory::create. 0 selects the default
+		int stackSize = 0;
+
+		// Kept for the life of the task; applies each time it is woken or
+		// yields
+		Priority priority = Priority::Normal;
+
+		// Group whose share of the workers the task runs in. nullptr
+		// selects the spawning task's group, or the scheduler's default
+		// group when spawned from outside the scheduler
+		TaskGroup* group = nullptr;
+
+		// Time the task should finish by. Runnable tasks with a deadline
+		// are dispatched earliest deadline first, ahead of every priority
+		// and group. Their run time is still charged to their group and
+		// they count against its maxRunnable, but they don't wait for
+		// the group's share. Default constructed for none
+		std::chrono::high_resolution_clock::time_point deadline;
+	};
+
+	// Parameters for createTaskGroup
+	struct TaskGroupOptions
+	{
+		// Share of worker time relative to the other runnable groups. The
+		// default group has weight 1
+		int weight = 1;
+
+		// Most tasks of the group runnable at once, queued or running.
+		// Tasks woken past the cap are held in order until one switches
+		// out without being requeued. 0 for no cap
+		int maxRunnable = 0;
+	};
+
+	enum class TaskState
+	{
+		Runnable,
+		Running,
+		Suspended,
+		Blocked,
+		Sleeping,
+	};
+
+	// Snapshot of a live task reported by dumpTasks
+	struct TaskInfo
+	{
+		Task* task;
+		const char* name;
+		TaskState state;
+		Priority priority;
+
+		// TaskOptions::deadline
+		std::chrono::high_resolution_clock::time_point deadline;
+
+		// index of the worker executing the task (TaskState::Running)
+		int worker;
+
+		// semaphore the task is waiting on (TaskState::Blocked)
+		const void* waitObject;
+
+		// when the task is due to wake (TaskState::Sleeping)
+		std::chrono::high_resolution_clock::time_point wakeTime;
+	};
+
+	// Stack usage of all tasks sharing a name, reported by dumpStackUsage
+	struct StackUsageInfo
+	{
+		// task name (nullptr for unnamed tasks)
+		const char* name;
+
+		// number of measured tasks
+		uint64_t samples;
+
+		// high-water mark, in bytes
+		size_t maxUsed;
+		size_t averageUsed;
+
+		// largest stack a measured task was given
+		size_t stackSize;
+
+		// size SchedulerOptions::adaptiveStacks will request for this
+		// name (0 while the default is used)
+		int adaptiveSize;
+	};
+
+	// Run queue counters for a single Priority
+	struct PriorityStats
+	{
+		// tasks spawned at this priority
+		uint64_t spawned;
+
+		// tasks dispatched, counting every wake and yield
+		uint64_t dispatched;
+
+		// dispatches taken ahead of a higher priority by aging
+		uint64_t aged;
+
+		// tasks currently waiting to run
+		int queued;
+	};
+
+	// Scheduler counters reported by getSchedulerStats
+	struct SchedulerStats
+	{
+		// indexed by Priority
+		PriorityStats priorities[3];
+
+		// tasks spawned with a deadline that returned by it, or after it
+		uint64_t deadlinesMet;
+		uint64_t deadlinesMissed;
+
+		// times a task was dispatched after its deadline had passed
+		uint64_t lateDispatches;
+
+		// yields forced by SchedulerOptions::coopBudget
+		uint64_t coopYields;
+
+		// tasks requeued from a PreemptibleScope by
+		// SchedulerOptions::preemptSliceMS
+		uint64_t preemptions;
+
+		// worker threads currently running, and those started and retired
+		// by SchedulerOptions::maxWorkers
+		int workers;
+		uint64_t workersStarted;
+		uint64_t workersRetired;
+	};
+
 	Scheduler* createScheduler(FiberFactory* factory);
+	Scheduler* createScheduler(FiberFactory* factory, const SchedulerOptions& options);
 	void destroyScheduler(Scheduler* scheduler);
 
 	// get the fiber factory for a scheduler
 	FiberFactory* getFiberFactory(Scheduler* scheduler);
 
+	// get a snapshot of the scheduler's run queue counters
+	SchedulerStats getSchedulerStats(Scheduler* scheduler);
+
+	// Create a group of tasks that shares the workers fairly with other
+	// groups. Runnable tasks are queued per group, and workers pick the
+	// group whose tasks have run the least for its weight, so a group
+	// flooding the scheduler only delays its own tasks. Priorities order
+	// tasks within a group
+	TaskGroup* createTaskGroup(Scheduler* scheduler, const TaskGroupOptions& options);
+
+	// Destroy a group once its tasks have finished. Waits for tasks that
+	// are still on their way out, so it must not be called from a task in
+	// the group
+	void destroyTaskGroup(TaskGroup* group);
+
 	// runs the scheduler on this thread
 	void run(Scheduler* scheduler, const RunContext* runContext);
 
 	// create a scheduler on this thread until entry returns
 	void runFunction(FiberFactory* factory, int nthreads, std::function<void(sched::Scheduler* scheduler)> entry);
+	void runFunction(FiberFactory* factory, int nthreads, const SchedulerOptions& options, std::function<void(sched::Scheduler* scheduler)> entry);
 
 	// Create a new task on the specified scheduler
 	Task* spawn(Scheduler* scheduler, std::function<void()> entry, int stackSize = 0);
+	Task* spawn(Scheduler* scheduler, std::function<void()> entry, const TaskOptions& options);
 
 	// Create a new task on the current task's scheduler
 	Task* spawn(std::function<void()> entry, int stackSize = 0);
+	Task* spawn(std::function<void()> entry, const TaskOptions& options);
 
-	// Gets the currently executing task
+	// Create count tasks calling entry(0) through entry(count - 1). The
+	// tasks are queued together under a single lock acquisition, and one
+	// idle worker is woken for each, so large fan-outs don't pay the
+	// queueing and wakeup cost once per task
+	void spawnMany(Scheduler* scheduler, int count, std::function<void(int index)> entry);
+	void spawnMany(Scheduler* scheduler, int count, std::function<void(int index)> entry, const TaskOptions& options);
+	void spawnMany(int count, std::function<void(int index)> entry);
+	void spawnMany(int count, std::function<void(int index)> entry, const TaskOptions& options);
+
+	// Gets the currently executing task, or nullptr when called from a
+	// thread that is not running a scheduler
 	Task* currentTask();
 
 	// Yeild control back to the scheduler. The current task will be
 	// automatically rescheduler to continue. Blocks until the current task
-	// is scheduled
+	// is scheduled. Outside of a task, yields the calling thread
 	void yield();
 
 	// Suspends the task. This blocks until a corresponding call to
@@ -74,4 +306,44 @@ namespace sched {
 	// call to suspendSelf to return.
 	void wake(Task* t);
 
+	// Wakes ntasks tasks, in order. Tasks of the same scheduler are queued
+	// under a single lock acquisition (or a single push to its inbox from
+	// outside the scheduler), and at most one idle worker is woken per task
+	void wakeMany(Task* const* tasks, int ntasks);
+
+	// Runs fn on a separate pool of threads and suspends the current task
+	// until it returns, so calls that block the OS thread (DNS lookups,
+	// blocking client libraries) never hold a worker. The pool grows with
+	// demand and its threads exit after sitting idle. An exception thrown
+	// by fn is rethrown in the calling task. Outside of a task, fn is
+	// called directly.
+	void blockingCall(const std::function<void()>& fn);
+
+	// Marks code in which the current task may be preempted at any
+	// instruction (see SchedulerOptions::preemptSliceMS): pure computation
+	// that takes no locks, doesn't allocate, doesn't touch thread_local
+	// state and doesn't call into sched. The task may resume on another
+	// thread. Outside of a task, has no effect
+	class PreemptibleScope
+	{
+	public:
+		PreemptibleScope();
+		~PreemptibleScope();
+
+	private:
+		PreemptibleScope(const PreemptibleScope&) = delete;
+		PreemptibleScope& operator=(const PreemptibleScope&) = delete;
+
+		Task* task;
+	};
+
+	// Reports every live task to callback. Requires
+	// SchedulerOptions::trackTasks, otherwise no tasks are reported. The
+	// callback is invoked after the registry is unlocked, so it may use the
+	// scheduler freely, but the reported tasks may have exited by then.
+	void dumpTasks(Scheduler* scheduler, std::function<void(const TaskInfo& info)> callback);
+
+	// Reports stack usage measured by SchedulerOptions::profileStacks
+	void dumpStackUsage(Scheduler* scheduler, std::function<void(const StackUsageInfo& info)> callback);
+
 } // namespace sched
@@ -26,10 +26,12 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 
 namespace sched {
 
-	// Scheduler aware semaphore
+	// Scheduler aware semaphore. Tasks waiting in acquire are suspended;
+	// threads that aren't running a scheduler are blocked instead
 	class Sema
 	{
 	public:
@@ -40,7 +42,9 @@ namespace sched {
 
 		void acquire();
 		bool try_acquire();
-		void release();
+
+		// adds count to the semaphore, waking up to count waiters at once
+		void release(uint32_t count = 1);
 
 	private:
 		Sema(const Sema&) = delete;
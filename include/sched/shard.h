@@ -0,0 +1,62 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+#include <functional>
+#include "sched/scheduler.h"
+
+namespace sched {
+
+	// Share-nothing mode. Runs nshards schedulers with a single worker
+	// each, every worker pinned to its own CPU (nshards <= 0 starts one per
+	// CPU). Each shard keeps its own run queue, poller and io_uring, and
+	// tasks never migrate between shards: work only crosses over through
+	// spawnOn and postTo. options apply to every shard, except that
+	// deterministic, pinWorkers and maxWorkers are ignored. entry runs as a task on
+	// shard 0, and all shards stop once it returns
+	void runSharded(FiberFactory* factory, int nshards, const SchedulerOptions& options, std::function<void()> entry);
+
+	// shards of the calling task's runSharded (0 outside of one)
+	int shardCount();
+
+	// shard the calling task runs on (-1 outside of runSharded)
+	int currentShard();
+
+	// scheduler of a shard, e.g. for createTaskGroup or getSchedulerStats
+	Scheduler* shardScheduler(int shard);
+
+	// Create a task on another shard (or the current one). The task is
+	// created by the target shard itself, which takes the request from
+	// its lock-free message queue
+	void spawnOn(int shard, std::function<void()> entry);
+	void spawnOn(int shard, std::function<void()> entry, const TaskOptions& options);
+
+	// Queue fn to run on a shard without creating a task for it. Messages
+	// from one sender run in order, one at a time, on the shard's message
+	// task, so fn must not suspend
+	void postTo(int shard, std::function<void()> fn);
+
+} // namespace sched
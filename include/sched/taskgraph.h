@@ -0,0 +1,87 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <vector>
+#include "sched/scheduler.h"
+#include "sched/sema.h"
+
+namespace sched {
+
+	// A reusable DAG of work. Nodes and edges are declared up front, then
+	// the whole graph is run as often as needed; each run only resets the
+	// dependency counters. A node becomes a task only once all of its
+	// predecessors have finished, and a finishing node continues straight
+	// into one of the successors it released, on the same stack, if that
+	// successor was added with the same TaskOptions.
+	class TaskGraph
+	{
+	public:
+		typedef int Node;
+
+		TaskGraph() = default;
+
+		// add a node. Must not be called while the graph is running
+		Node add(std::function<void()> fn);
+		Node add(std::function<void()> fn, const TaskOptions& options);
+
+		// before must finish before after starts. The graph must stay
+		// acyclic
+		void precede(Node before, Node after);
+
+		// run every node on the scheduler (or the current task's scheduler)
+		// and block until all have finished. A graph runs one at a time
+		void run(Scheduler* scheduler);
+		void run();
+
+	private:
+		TaskGraph(const TaskGraph&) = delete;
+		TaskGraph& operator=(const TaskGraph&) = delete;
+
+		struct NodeData
+		{
+			std::function<void()> fn;
+			TaskOptions options;
+			std::vector<Node> successors;
+			int dependencies = 0;
+
+			// predecessors yet to finish in the current run
+			std::atomic<int> pending = ATOMIC_VAR_INIT(0);
+		};
+
+		void spawnNode(Node node);
+		void execute(Node node);
+
+		std::deque<NodeData> nodes;
+		Scheduler* scheduler = nullptr;
+		std::atomic<int> remaining = ATOMIC_VAR_INIT(0);
+		Sema done;
+	};
+
+} // namespace sched
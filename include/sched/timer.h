@@ -27,7 +27,8 @@
 
 namespace sched {
 
-	// suspend the current task for the specified number of milliseconds
+	// suspend the current task for the specified number of milliseconds.
+	// Outside of a task, sleeps the calling thread
 	void sleepMS(int ms);
 
 } // namespace sched
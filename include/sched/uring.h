@@ -0,0 +1,55 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+#pragma once
+
+#if defined(__linux__)
+
+#include <cstdint>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+namespace sched {
+
+	// true if the kernel supports io_uring
+	bool uringAvailable();
+
+	// Operations submitted through the io_uring of the calling task's
+	// worker. The task is suspended until the operation completes while the
+	// worker keeps running other tasks; submissions are batched into one
+	// io_uring_enter per scheduling round. Return values and errno match the
+	// corresponding system calls (pread, pwrite, fsync/fdatasync, accept).
+	// offset -1 uses the file position. Outside of a task the system call is
+	// made directly. Fails with ENOSYS if io_uring is unavailable.
+	ssize_t uringRead(int fd, void* buf, size_t count, int64_t offset);
+	ssize_t uringWrite(int fd, const void* buf, size_t count, int64_t offset);
+	int uringFsync(int fd, bool dataOnly);
+
+	// Accepted sockets are created non-blocking
+	int uringAccept(int fd, sockaddr* addr, socklen_t* addrlen);
+
+} // namespace sched
+
+#endif // defined(__linux__)
@@ -0,0 +1,51 @@
+local SCHED_DIR = path.getdirectory(_SCRIPT) .. "/"
+
+project "sched-bench"
+	kind "ConsoleApp"
+
+	files {
+		SCHED_DIR .. "bench/fiber.*",
+		SCHED_DIR .. "bench/harness.*",
+		SCHED_DIR .. "bench/micro.cpp",
+	}
+
+	includedirs {
+		SCHED_DIR .. "include/",
+	}
+
+	links {
+		"sched",
+	}
+
+	optimize "Speed"
+
+	filter "system:linux"
+		links {
+			"pthread",
+		}
+
+	filter {}
+
+project "sched-macrobench"
+	kind "ConsoleApp"
+
+	files {
+		SCHED_DIR .. "bench/fiber.*",
+		SCHED_DIR .. "bench/harness.*",
+		SCHED_DIR .. "bench/macro.cpp",
+	}
+
+	includedirs {
+		SCHED_DIR .. "include/",
+	}
+
+	links {
+		"sched",
+	}
+
+	optimize "Speed"
+
+	filter "system:linux"
+		links {
+			"pthread",
+		}
@@ -18,3 +18,4 @@ workspace "sched"
 	symbols "On"
 
 dofile("premake5.sched.lua")
+dofile("premake5.bench.lua")
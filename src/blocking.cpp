@@ -0,0 +1,182 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include "private.h"
+#include "sched/scheduler.h"
+
+using namespace sched;
+
+namespace {
+
+	// lives on the stack of the task waiting for it
+	struct BlockingJob
+	{
+		const std::function<void()>* fn;
+		Task* task;
+		BlockingJob* next;
+
+		// thrown by fn, rethrown in the task
+		std::exception_ptr error;
+	};
+
+	struct BlockingPool
+	{
+		std::mutex lock;
+		std::condition_variable cond;
+		BlockingJob* front = nullptr;
+		BlockingJob* last = nullptr;
+		int queued = 0;
+		int threads = 0;
+		int idle = 0;
+	};
+
+} // namespace `anonymous'
+
+// upper bound on threads; beyond this calls queue up
+static constexpr int c_maxBlockingThreads = 512;
+
+// threads idle this long exit
+static constexpr std::chrono::seconds c_blockingIdleTimeout(10);
+
+// threads are never joined, so the pool is never destroyed
+static std::once_flag g_blockingPoolCreated;
+static BlockingPool* g_blockingPool;
+
+static void blockingThread(BlockingPool* pool)
+{
+	std::unique_lock<std::mutex> lock(pool->lock);
+	for (;;)
+	{
+		while (!pool->front)
+		{
+			++pool->idle;
+			const std::cv_status status = pool->cond.wait_for(lock, c_blockingIdleTimeout);
+			--pool->idle;
+
+			if (status == std::cv_status::timeout && !pool->front)
+			{
+				--pool->threads;
+				return;
+			}
+		}
+
+		BlockingJob* job = pool->front;
+		--pool->queued;
+		pool->front = job->next;
+		if (!pool->front)
+		{
+			pool->last = nullptr;
+		}
+
+		lock.unlock();
+
+		// an exception escaping a detached thread would terminate the
+		// process
+		try
+		{
+			(*job->fn)();
+		}
+		catch (...)
+		{
+			job->error = std::current_exception();
+		}
+
+		// the job is gone once its task runs
+		wake(job->task);
+
+		lock.lock();
+	}
+}
+
+// queue a job once its task has switched out
+static void blockingSubmit(void* context)
+{
+	BlockingJob* job = static_cast<BlockingJob*>(context);
+	BlockingPool* pool = g_blockingPool;
+
+	bool startThread = false;
+	{
+		std::unique_lock<std::mutex> lock(pool->lock);
+		job->next = nullptr;
+		if (pool->last)
+		{
+			pool->last->next = job;
+		}
+		else
+		{
+			pool->front = job;
+		}
+		pool->last = job;
+		++pool->queued;
+
+		// grow whenever nobody is free to take the job
+		if (pool->queued > pool->idle && pool->threads < c_maxBlockingThreads)
+		{
+			++pool->threads;
+			startThread = true;
+		}
+	}
+
+	if (startThread)
+	{
+		std::thread(blockingThread, pool).detach();
+	}
+	else
+	{
+		pool->cond.notify_one();
+	}
+}
+
+void sched::blockingCall(const std::function<void()>& fn)
+{
+	Task* task = currentTask();
+	if (!task)
+	{
+		fn();
+		return;
+	}
+
+	std::call_once(g_blockingPoolCreated, []() {
+		g_blockingPool = new BlockingPool;
+	});
+
+	BlockingJob job;
+	job.fn = &fn;
+	job.task = task;
+
+	taskSetBlocked(task, g_blockingPool);
+	suspendWithUnlock(task, blockingSubmit, &job);
+
+	if (job.error)
+	{
+		std::rethrow_exception(job.error);
+	}
+}
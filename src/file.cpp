@@ -0,0 +1,375 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if !defined(_WIN32)
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <mutex>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include "private.h"
+#include "sched/file.h"
+#include "sched/scheduler.h"
+
+#if defined(__linux__)
+#include "sched/uring.h"
+#endif
+
+using namespace sched;
+
+namespace {
+
+	enum class FileOp
+	{
+		Read,
+		Write,
+		Sync,
+	};
+
+	// lives on the stack of the task waiting for it
+	struct FileJob
+	{
+		FileOp op;
+		int fd;
+		void* buf;
+		size_t count;
+		int64_t offset;
+		ssize_t result;
+		int error;
+		Task* task;
+		FileJob* next;
+	};
+
+	// helper threads performing blocking file operations
+	struct FilePool
+	{
+		std::mutex lock;
+		std::condition_variable cond;
+		FileJob* front = nullptr;
+		FileJob* last = nullptr;
+		int threads = 0;
+		int idle = 0;
+	};
+
+} // namespace `anonymous'
+
+static constexpr int c_maxHelpers = 8;
+
+// limits on merging adjacent reads
+static constexpr int c_maxCoalesce = 16;
+static constexpr int c_coalesceScan = 64;
+
+// helpers are never joined, so the pool is never destroyed
+static std::once_flag g_filePoolCreated;
+static FilePool* g_filePool;
+
+// perform a single operation or a run of contiguous reads
+static void fileRun(FileJob** jobs, int njobs)
+{
+	FileJob* job = jobs[0];
+	if (1 == njobs)
+	{
+		switch (job->op)
+		{
+		case FileOp::Read:
+			job->result = job->offset < 0 ? ::read(job->fd, job->buf, job->count) : ::pread(job->fd, job->buf, job->count, job->offset);
+			break;
+		case FileOp::Write:
+			job->result = job->offset < 0 ? ::write(job->fd, job->buf, job->count) : ::pwrite(job->fd, job->buf, job->count, job->offset);
+			break;
+		case FileOp::Sync:
+			job->result = ::fsync(job->fd);
+			break;
+		}
+
+		job->error = errno;
+		return;
+	}
+
+	iovec iov[c_maxCoalesce];
+	for (int ii = 0; ii != njobs; ++ii)
+	{
+		iov[ii].iov_base = jobs[ii]->buf;
+		iov[ii].iov_len = jobs[ii]->count;
+	}
+
+	ssize_t remaining = ::preadv(job->fd, iov, njobs, job->offset);
+	const int error = errno;
+
+	// pread only comes up short at the end of the file, so the bytes read
+	// fill the requests in order
+	for (int ii = 0; ii != njobs; ++ii)
+	{
+		jobs[ii]->error = error;
+		if (remaining < 0)
+		{
+			jobs[ii]->result = -1;
+		}
+		else
+		{
+			jobs[ii]->result = std::min(remaining, static_cast<ssize_t>(jobs[ii]->count));
+			remaining -= jobs[ii]->result;
+		}
+	}
+}
+
+// take the front job, along with queued reads of the same file that extend
+// it into one contiguous range
+static int fileTakeBatchWithLock(FilePool* pool, FileJob** batch)
+{
+	FileJob* first = pool->front;
+	batch[0] = first;
+	int nbatch = 1;
+
+	if (first->op == FileOp::Read && first->offset >= 0)
+	{
+		FileJob* candidates[c_coalesceScan];
+		int ncandidates = 0;
+		for (FileJob* job = first->next; job && ncandidates < c_coalesceScan; job = job->next)
+		{
+			if (job->op == FileOp::Read && job->fd == first->fd && job->offset >= 0)
+			{
+				candidates[ncandidates++] = job;
+			}
+		}
+
+		// grow the range in both directions
+		int64_t begin = first->offset;
+		int64_t end = first->offset + static_cast<int64_t>(first->count);
+		for (bool grew = true; grew && nbatch < c_maxCoalesce; )
+		{
+			grew = false;
+			for (int ii = 0; ii != ncandidates && nbatch < c_maxCoalesce; ++ii)
+			{
+				FileJob* job = candidates[ii];
+				if (!job)
+				{
+					continue;
+				}
+
+				if (job->offset == end)
+				{
+					end += static_cast<int64_t>(job->count);
+				}
+				else if (job->offset + static_cast<int64_t>(job->count) == begin)
+				{
+					begin = job->offset;
+				}
+				else
+				{
+					continue;
+				}
+
+				batch[nbatch++] = job;
+				candidates[ii] = nullptr;
+				grew = true;
+			}
+		}
+
+		std::sort(batch, batch + nbatch, [](const FileJob* a, const FileJob* b) {
+			return a->offset < b->offset;
+		});
+	}
+
+	// unlink the batch from the queue
+	FileJob* prev = nullptr;
+	FileJob** link = &pool->front;
+	for (int remaining = nbatch; *link && remaining; )
+	{
+		FileJob* job = *link;
+		if (batch + nbatch != std::find(batch, batch + nbatch, job))
+		{
+			if (job == pool->last)
+			{
+				pool->last = prev;
+			}
+
+			*link = job->next;
+			--remaining;
+		}
+		else
+		{
+			prev = job;
+			link = &job->next;
+		}
+	}
+
+	return nbatch;
+}
+
+static void fileHelper(FilePool* pool)
+{
+	FileJob* batch[c_maxCoalesce];
+	Task* tasks[c_maxCoalesce];
+
+	std::unique_lock<std::mutex> lock(pool->lock);
+	for (;;)
+	{
+		while (!pool->front)
+		{
+			++pool->idle;
+			pool->cond.wait(lock);
+			--pool->idle;
+		}
+
+		const int nbatch = fileTakeBatchWithLock(pool, batch);
+		lock.unlock();
+
+		fileRun(batch, nbatch);
+
+		// the job is gone once its task runs
+		for (int ii = 0; ii != nbatch; ++ii)
+		{
+			tasks[ii] = batch[ii]->task;
+		}
+
+		wakeMany(tasks, nbatch);
+
+		lock.lock();
+	}
+}
+
+// queue a job once its task has switched out
+static void fileSubmit(void* context)
+{
+	FileJob* job = static_cast<FileJob*>(context);
+	FilePool* pool = g_filePool;
+
+	bool startHelper = false;
+	{
+		std::unique_lock<std::mutex> lock(pool->lock);
+		job->next = nullptr;
+		if (pool->last)
+		{
+			pool->last->next = job;
+		}
+		else
+		{
+			pool->front = job;
+		}
+		pool->last = job;
+
+		if (0 == pool->idle && pool->threads < c_maxHelpers)
+		{
+			++pool->threads;
+			startHelper = true;
+		}
+	}
+
+	if (startHelper)
+	{
+		std::thread(fileHelper, pool).detach();
+	}
+	else
+	{
+		pool->cond.notify_one();
+	}
+}
+
+static ssize_t fileCall(FileOp op, int fd, void* buf, size_t count, int64_t offset)
+{
+	FileJob job;
+	job.op = op;
+	job.fd = fd;
+	job.buf = buf;
+	job.count = count;
+	job.offset = offset;
+	job.task = currentTask();
+
+	FileJob* jobs[1] = {&job};
+	if (!job.task)
+	{
+		fileRun(jobs, 1);
+		return job.result;
+	}
+
+	std::call_once(g_filePoolCreated, []() {
+		g_filePool = new FilePool;
+	});
+
+	taskSetBlocked(job.task, g_filePool);
+	suspendWithUnlock(job.task, fileSubmit, &job);
+
+	if (job.result < 0)
+	{
+		errno = job.error;
+	}
+
+	return job.result;
+}
+
+ssize_t sched::fileRead(int fd, void* buf, size_t count, int64_t offset)
+{
+#if defined(__linux__)
+	if (currentTask() && uringAvailable())
+	{
+		const ssize_t result = uringRead(fd, buf, count, offset);
+		if (result >= 0 || errno != ENOSYS)
+		{
+			return result;
+		}
+	}
+#endif
+
+	return fileCall(FileOp::Read, fd, buf, count, offset);
+}
+
+ssize_t sched::fileWrite(int fd, const void* buf, size_t count, int64_t offset)
+{
+#if defined(__linux__)
+	if (currentTask() && uringAvailable())
+	{
+		const ssize_t result = uringWrite(fd, buf, count, offset);
+		if (result >= 0 || errno != ENOSYS)
+		{
+			return result;
+		}
+	}
+#endif
+
+	return fileCall(FileOp::Write, fd, const_cast<void*>(buf), count, offset);
+}
+
+int sched::fsync(int fd)
+{
+#if defined(__linux__)
+	if (currentTask() && uringAvailable())
+	{
+		const int result = uringFsync(fd, false);
+		if (result >= 0 || errno != ENOSYS)
+		{
+			return result;
+		}
+	}
+#endif
+
+	return static_cast<int>(fileCall(FileOp::Sync, fd, nullptr, 0, -1));
+}
+
+#endif // !defined(_WIN32)
@@ -0,0 +1,605 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "private.h"
+#include "sched/scheduler.h"
+
+using namespace sched;
+
+#if defined(__linux__)
+
+#include <cerrno>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "sched/net.h"
+
+namespace {
+
+	// a task waiting on a PollSlot, chained to those that queued before it.
+	// Lives on the waiting task's stack
+	struct PollWaiter
+	{
+		Task* task;
+		PollWaiter* next;
+	};
+
+	// one direction of a descriptor. Holds 0, c_pollReady (readiness was
+	// reported with nobody waiting) or the newest PollWaiter
+	typedef std::atomic<uintptr_t> PollSlot;
+
+	struct PollDesc
+	{
+		int fd;
+		bool registered = false; // owned by NetPoller::lock
+		PollSlot readers = ATOMIC_VAR_INIT(0);
+		PollSlot writers = ATOMIC_VAR_INIT(0);
+
+		// set for descriptors added with netpollAddSource
+		NetPollCollect* collect = nullptr;
+		void* collectContext;
+	};
+
+} // namespace `anonymous'
+
+static constexpr uintptr_t c_pollReady = 1;
+static constexpr int c_maxEvents = 64;
+
+struct sched::NetPoller
+{
+	int epfd;
+	int breakfd;
+	std::atomic<bool> breakPending = ATOMIC_VAR_INIT(false);
+
+	// number of tasks suspended in a PollSlot
+	std::atomic<int> waiters = ATOMIC_VAR_INIT(0);
+
+	// descriptors indexed by fd. Entries are never freed, as events for a
+	// closed descriptor may still be in flight
+	std::mutex lock;
+	std::vector<PollDesc*> descs;
+	std::vector<PollDesc*> sources;
+};
+
+NetPoller* sched::netpollCreate()
+{
+	const int epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (-1 == epfd)
+	{
+		return nullptr;
+	}
+
+	const int breakfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (-1 == breakfd)
+	{
+		::close(epfd);
+		return nullptr;
+	}
+
+	// the break descriptor is identified by a null pointer
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = nullptr;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, breakfd, &ev);
+
+	NetPoller* np = new NetPoller;
+	np->epfd = epfd;
+	np->breakfd = breakfd;
+	return np;
+}
+
+void sched::netpollDestroy(NetPoller* np)
+{
+	if (np)
+	{
+		::close(np->breakfd);
+		::close(np->epfd);
+		for (PollDesc* pd : np->descs)
+		{
+			delete(pd);
+		}
+
+		for (PollDesc* pd : np->sources)
+		{
+			delete(pd);
+		}
+
+		delete(np);
+	}
+}
+
+bool sched::netpollWaiting(NetPoller* np)
+{
+	return np && np->waiters.load(std::memory_order_relaxed) > 0;
+}
+
+bool sched::netpollAddSource(NetPoller* np, int fd, NetPollCollect* collect, void* context)
+{
+	PollDesc* pd = new PollDesc;
+	pd->fd = fd;
+	pd->collect = collect;
+	pd->collectContext = context;
+
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = pd;
+	if (0 != epoll_ctl(np->epfd, EPOLL_CTL_ADD, fd, &ev))
+	{
+		delete(pd);
+		return false;
+	}
+
+	std::unique_lock<std::mutex> lock(np->lock);
+	np->sources.push_back(pd);
+	return true;
+}
+
+void sched::netpollAddWaiters(NetPoller* np, int delta)
+{
+	np->waiters.fetch_add(delta);
+}
+
+// record readiness on a slot. Returns the tasks waiting on it, if any
+static PollWaiter* slotReady(PollSlot* slot)
+{
+	uintptr_t old = slot->load();
+	for (;;)
+	{
+		if (old == c_pollReady)
+		{
+			return nullptr;
+		}
+
+		const uintptr_t next = (old == 0) ? c_pollReady : 0;
+		if (slot->compare_exchange_weak(old, next))
+		{
+			return reinterpret_cast<PollWaiter*>(old);
+		}
+	}
+}
+
+// hand the waiters of a ready slot back to the caller, waking those that
+// don't fit directly. Returns the number directly woken
+static int slotWake(PollWaiter* waiter, Task** tasks, int* ntasks, int maxTasks)
+{
+	int woken = 0;
+	while (waiter)
+	{
+		// the waiter is gone as soon as its task resumes
+		PollWaiter* next = waiter->next;
+		if (*ntasks < maxTasks)
+		{
+			tasks[(*ntasks)++] = waiter->task;
+		}
+		else
+		{
+			wake(waiter->task);
+			++woken;
+		}
+
+		waiter = next;
+	}
+
+	return woken;
+}
+
+int sched::netpollWait(NetPoller* np, int timeoutMS, Task** tasks, int maxTasks)
+{
+	// each event can release both a reader and a writer
+	epoll_event events[c_maxEvents];
+	const int nevents = epoll_wait(np->epfd, events, std::min(c_maxEvents, maxTasks / 2), timeoutMS);
+
+	int ntasks = 0;
+	int woken = 0;
+	for (int ii = 0; ii < nevents; ++ii)
+	{
+		PollDesc* pd = static_cast<PollDesc*>(events[ii].data.ptr);
+		if (!pd)
+		{
+			uint64_t value;
+			while (::read(np->breakfd, &value, sizeof(value)) > 0)
+			{
+			}
+
+			np->breakPending.store(false);
+			continue;
+		}
+
+		// sources are collected below, with whatever capacity remains
+		if (pd->collect)
+		{
+			continue;
+		}
+
+		const uint32_t ev = events[ii].events;
+		if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+		{
+			woken += slotWake(slotReady(&pd->readers), tasks, &ntasks, maxTasks);
+		}
+
+		if (ev & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+		{
+			woken += slotWake(slotReady(&pd->writers), tasks, &ntasks, maxTasks);
+		}
+	}
+
+	for (int ii = 0; ii < nevents; ++ii)
+	{
+		PollDesc* pd = static_cast<PollDesc*>(events[ii].data.ptr);
+		if (pd && pd->collect)
+		{
+			ntasks += (pd->collect)(pd->collectContext, tasks + ntasks, maxTasks - ntasks);
+		}
+	}
+
+	np->waiters.fetch_sub(ntasks + woken);
+	return ntasks;
+}
+
+void sched::netpollBreak(NetPoller* np)
+{
+	if (np && !np->breakPending.exchange(true))
+	{
+		const uint64_t one = 1;
+		const ssize_t result = ::write(np->breakfd, &one, sizeof(one));
+		(void)result;
+	}
+}
+
+// get the descriptor state for fd
+static PollDesc* pollDesc(NetPoller* np, int fd)
+{
+	std::unique_lock<std::mutex> lock(np->lock);
+	if (static_cast<size_t>(fd) >= np->descs.size())
+	{
+		np->descs.resize(static_cast<size_t>(fd) + 1, nullptr);
+	}
+
+	PollDesc* pd = np->descs[fd];
+	if (!pd)
+	{
+		pd = new PollDesc;
+		pd->fd = fd;
+		np->descs[fd] = pd;
+	}
+
+	return pd;
+}
+
+// make sure the descriptor is in the epoll set before waiting on it. One
+// closed without sched::close drops out of the set by itself and its number
+// may have been reused since, so the add is repeated for every wait; an
+// existing registration fails it with EEXIST. Returns false (with errno
+// set) if the descriptor can't be polled
+static bool pollRegister(NetPoller* np, PollDesc* pd)
+{
+	// edge triggered: each slot records readiness until it is consumed
+	epoll_event ev;
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = pd;
+
+	std::unique_lock<std::mutex> lock(np->lock);
+	if (0 == epoll_ctl(np->epfd, EPOLL_CTL_ADD, pd->fd, &ev) || errno == EEXIST)
+	{
+		pd->registered = true;
+		return true;
+	}
+
+	pd->registered = false;
+	return false;
+}
+
+static int waitSlot(int fd, short events, bool readers)
+{
+	NetPoller* np = netpollCurrent();
+	if (!np)
+	{
+		// not running on a scheduler; block the thread instead
+		pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = events;
+		::poll(&pfd, 1, -1);
+		return 0;
+	}
+
+	if (fd < 0)
+	{
+		errno = EBADF;
+		return -1;
+	}
+
+	PollDesc* pd = pollDesc(np, fd);
+	PollSlot* slot = readers ? &pd->readers : &pd->writers;
+
+	// consume readiness reported since the last wait
+	uintptr_t expected = c_pollReady;
+	if (slot->compare_exchange_strong(expected, 0))
+	{
+		return 0;
+	}
+
+	// nothing could wake us
+	if (!pollRegister(np, pd))
+	{
+		return -1;
+	}
+
+	struct Context
+	{
+		NetPoller* np;
+		PollSlot* slot;
+		PollWaiter waiter;
+	};
+
+	Context ctx;
+	ctx.np = np;
+	ctx.slot = slot;
+	ctx.waiter.task = currentTask();
+
+	// publish ourselves only once the task is fully suspended, so the poller
+	// can wake us immediately
+	taskSetBlocked(ctx.waiter.task, pd);
+	suspendWithUnlock(ctx.waiter.task, [](void* context) {
+		Context* ctx = static_cast<Context*>(context);
+		Task* task = ctx->waiter.task;
+		NetPoller* np = ctx->np;
+
+		np->waiters.fetch_add(1);
+
+		uintptr_t old = ctx->slot->load();
+		for (;;)
+		{
+			// became ready while we were suspending
+			if (old == c_pollReady)
+			{
+				if (ctx->slot->compare_exchange_weak(old, 0))
+				{
+					np->waiters.fetch_sub(1);
+					wake(task);
+					return;
+				}
+
+				continue;
+			}
+
+			ctx->waiter.next = reinterpret_cast<PollWaiter*>(old);
+			if (ctx->slot->compare_exchange_weak(old, reinterpret_cast<uintptr_t>(&ctx->waiter)))
+			{
+				return;
+			}
+		}
+	}, &ctx);
+
+	return 0;
+}
+
+int sched::waitReadable(int fd)
+{
+	return waitSlot(fd, POLLIN, true);
+}
+
+int sched::waitWritable(int fd)
+{
+	return waitSlot(fd, POLLOUT, false);
+}
+
+static bool wouldBlock()
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+ssize_t sched::read(int fd, void* buf, size_t count)
+{
+	coopConsume();
+
+	for (;;)
+	{
+		const ssize_t n = ::read(fd, buf, count);
+		if (n >= 0 || (errno != EINTR && !wouldBlock()))
+		{
+			return n;
+		}
+
+		if (wouldBlock() && 0 != waitReadable(fd))
+		{
+			return -1;
+		}
+	}
+}
+
+ssize_t sched::write(int fd, const void* buf, size_t count)
+{
+	coopConsume();
+
+	for (;;)
+	{
+		const ssize_t n = ::write(fd, buf, count);
+		if (n >= 0 || (errno != EINTR && !wouldBlock()))
+		{
+			return n;
+		}
+
+		if (wouldBlock() && 0 != waitWritable(fd))
+		{
+			return -1;
+		}
+	}
+}
+
+int sched::accept(int fd, sockaddr* addr, socklen_t* addrlen)
+{
+	coopConsume();
+
+	for (;;)
+	{
+		const int result = ::accept4(fd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (result >= 0 || (errno != EINTR && !wouldBlock()))
+		{
+			return result;
+		}
+
+		if (wouldBlock() && 0 != waitReadable(fd))
+		{
+			return -1;
+		}
+	}
+}
+
+int sched::connect(int fd, const sockaddr* addr, socklen_t addrlen)
+{
+	if (0 == ::connect(fd, addr, addrlen))
+	{
+		return 0;
+	}
+
+	if (errno != EINPROGRESS && errno != EINTR)
+	{
+		return -1;
+	}
+
+	// wait for the connection to complete, then fetch its result
+	for (;;)
+	{
+		if (0 != waitWritable(fd))
+		{
+			return -1;
+		}
+
+		int error = 0;
+		socklen_t len = sizeof(error);
+		if (-1 == getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len))
+		{
+			return -1;
+		}
+
+		if (error == 0)
+		{
+			// ignore spurious wakeups: a connected socket has a peer
+			sockaddr_storage peer;
+			socklen_t peerlen = sizeof(peer);
+			if (0 == getpeername(fd, reinterpret_cast<sockaddr*>(&peer), &peerlen))
+			{
+				return 0;
+			}
+
+			if (errno == ENOTCONN)
+			{
+				continue;
+			}
+
+			return -1;
+		}
+
+		errno = error;
+		return -1;
+	}
+}
+
+int sched::close(int fd)
+{
+	std::vector<Task*> waiting;
+
+	NetPoller* np = netpollCurrent();
+	if (np)
+	{
+		std::unique_lock<std::mutex> lock(np->lock);
+		if (fd >= 0 && static_cast<size_t>(fd) < np->descs.size() && np->descs[fd])
+		{
+			PollDesc* pd = np->descs[fd];
+			if (pd->registered)
+			{
+				epoll_ctl(np->epfd, EPOLL_CTL_DEL, fd, nullptr);
+				pd->registered = false;
+			}
+
+			for (PollSlot* slot : {&pd->readers, &pd->writers})
+			{
+				const uintptr_t old = slot->exchange(0);
+				if (old > c_pollReady)
+				{
+					for (PollWaiter* waiter = reinterpret_cast<PollWaiter*>(old); waiter; waiter = waiter->next)
+					{
+						waiting.push_back(waiter->task);
+					}
+				}
+			}
+		}
+	}
+
+	const int result = ::close(fd);
+
+	// tasks still waiting retry their operation and fail with EBADF
+	if (!waiting.empty())
+	{
+		const int nwaiting = static_cast<int>(waiting.size());
+		np->waiters.fetch_sub(nwaiting);
+		wakeMany(waiting.data(), nwaiting);
+	}
+
+	return result;
+}
+
+#else
+
+NetPoller* sched::netpollCreate()
+{
+	return nullptr;
+}
+
+void sched::netpollDestroy(NetPoller*)
+{
+}
+
+bool sched::netpollWaiting(NetPoller*)
+{
+	return false;
+}
+
+int sched::netpollWait(NetPoller*, int, Task**, int)
+{
+	return 0;
+}
+
+void sched::netpollBreak(NetPoller*)
+{
+}
+
+bool sched::netpollAddSource(NetPoller*, int, NetPollCollect*, void*)
+{
+	return false;
+}
+
+void sched::netpollAddWaiters(NetPoller*, int)
+{
+}
+
+#endif // defined(__linux__)
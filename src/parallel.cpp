@@ -0,0 +1,176 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include "private.h"
+#include "sched/parallel.h"
+#include "sched/scheduler.h"
+#include "sched/sema.h"
+
+using namespace sched;
+
+namespace {
+
+	// one parallelRun call
+	struct ParallelState
+	{
+		detail::ParallelBody* body;
+		int64_t grain;
+		bool split;
+
+		// the caller's share plus every job queued or running. Only a
+		// pending piece can split, so this reaches zero exactly once
+		std::atomic<int> pending = ATOMIC_VAR_INIT(1);
+		Sema done;
+	};
+
+	struct RangeJob
+	{
+		Job job;
+		ParallelState* state;
+		int64_t begin;
+		int64_t end;
+	};
+
+} // namespace `anonymous'
+
+// split off half the remaining range whenever nothing is queued locally
+static constexpr int c_splitDepth = 1;
+
+// with an automatic grain, check the queue about this many times per
+// worker across the whole range
+static constexpr int64_t c_autoGrainChecks = 32;
+
+static void parallelFinish(ParallelState* state)
+{
+	if (1 == state->pending.fetch_sub(1))
+	{
+		state->done.release();
+	}
+}
+
+static void rangeJobRun(Job* job);
+
+// process [begin, end) using lazy binary splitting. The split test is one
+// relaxed load, so pieces are only created when some worker could take
+// one
+static void parallelRange(ParallelState* state, int64_t begin, int64_t end)
+{
+	detail::ParallelBody* body = state->body;
+	const int64_t grain = state->grain;
+
+	void* job = body->beginJob(begin);
+	while (begin != end)
+	{
+		if (state->split && end - begin >= 2 * grain && jobLocalDepth() < c_splitDepth)
+		{
+			const int64_t mid = begin + (end - begin) / 2;
+
+			RangeJob* half = new RangeJob;
+			half->job.run = rangeJobRun;
+			half->state = state;
+			half->begin = mid;
+			half->end = end;
+
+			state->pending.fetch_add(1);
+			if (jobPush(&half->job))
+			{
+				end = mid;
+				continue;
+			}
+
+			state->pending.fetch_sub(1);
+			delete(half);
+		}
+
+		const int64_t stop = std::min(end, begin + grain);
+		body->runChunk(job, begin, stop);
+		begin = stop;
+	}
+
+	body->endJob(job);
+}
+
+static void rangeJobRun(Job* job)
+{
+	RangeJob* rj = reinterpret_cast<RangeJob*>(job);
+	ParallelState* state = rj->state;
+	const int64_t begin = rj->begin;
+	const int64_t end = rj->end;
+	delete(rj);
+
+	parallelRange(state, begin, end);
+	parallelFinish(state);
+}
+
+int sched::detail::parallelWorkers()
+{
+	return jobWorkerCount();
+}
+
+void sched::detail::parallelRun(int64_t begin, int64_t end, int64_t grain, ParallelBody* body)
+{
+	if (begin >= end)
+	{
+		return;
+	}
+
+	const int nworkers = jobWorkerCount();
+	if (grain <= 0)
+	{
+		grain = std::max<int64_t>(1, (end - begin) / (std::max(1, nworkers) * c_autoGrainChecks));
+	}
+
+	// nobody else could take a piece
+	ParallelState state;
+	state.body = body;
+	state.grain = grain;
+	state.split = nworkers > 1;
+
+	parallelRange(&state, begin, end);
+	parallelFinish(&state);
+
+	// help with queued jobs (ours or anyone's) until our pieces are done
+	while (!state.done.try_acquire())
+	{
+		if (jobRunOne())
+		{
+			continue;
+		}
+
+		// everything left is running elsewhere. Tasks can sleep on it; a
+		// job's scheduler fiber can't, so it keeps polling
+		if (currentTask())
+		{
+			state.done.acquire();
+			break;
+		}
+
+		std::this_thread::yield();
+	}
+}
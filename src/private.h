@@ -25,15 +25,32 @@
 */
 #pragma once
 
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace sched {
+	struct Fiber;
+	struct FiberFactory;
+	struct StackUsageInfo;
 	struct Task;
 
 	void suspendWithUnlock(Task* t, void unlock(void* context), void* context);
 
+	// record why a task is about to suspend (reported by dumpTasks)
+	void taskSetBlocked(Task* t, const void* waitObject);
+	void taskSetSleeping(Task* t, std::chrono::high_resolution_clock::time_point when);
+
+	// spend one unit of the current task's SchedulerOptions::coopBudget.
+	// Once it runs out the task yields, so loops over operations that never
+	// block still let other tasks run. No-op outside of a task
+	void coopConsume();
+
 	struct TimerContext
 	{
 		struct Timer;
@@ -41,9 +58,128 @@ namespace sched {
 		std::mutex lock;
 		std::condition_variable cond;
 		std::vector<Timer*> timers;
+
+		// simulated clock, advanced by timerContextAdvance
+		bool virtualClock = false;
+		std::chrono::high_resolution_clock::time_point now;
 	};
 
+	// per task name stack usage
+	struct StackProfile
+	{
+		struct Site
+		{
+			uint64_t spawned = 0;
+			uint64_t samples = 0;
+			size_t maxUsed = 0;
+			size_t totalUsed = 0;
+			size_t stackSize = 0;
+			int adaptiveSize = 0;
+		};
+
+		std::mutex lock;
+		std::unordered_map<std::string, Site> sites;
+	};
+
+	// pick the stack size of a new task spawned with stackSize 0, and
+	// whether its stack should be painted
+	int stackProfileSelect(StackProfile* sp, const char* name, bool adaptive, bool* paint);
+
+	// fill the unused portion of the calling fiber's stack with a known
+	// pattern. Must be called from fiber itself
+	void stackPaint(FiberFactory* factory, Fiber* fiber);
+
+	// measure a painted stack before the fiber is released
+	void stackProfileRecord(StackProfile* sp, FiberFactory* factory, Fiber* fiber, const char* name);
+
+	void stackProfileDump(StackProfile* sp, const std::function<void(const StackUsageInfo& info)>& callback);
+
+	// descriptor readiness poller (epoll on Linux, unused elsewhere)
+	struct NetPoller;
+
+	// returns nullptr if the platform has no poller
+	NetPoller* netpollCreate();
+	void netpollDestroy(NetPoller* np);
+
+	// poller of the calling thread's scheduler
+	NetPoller* netpollCurrent();
+
+	// true if any task is suspended on a descriptor
+	bool netpollWaiting(NetPoller* np);
+
+	// collect up to maxTasks tasks whose descriptors became ready. Blocks for
+	// up to timeoutMS (-1 for no limit) or until netpollBreak is called
+	int netpollWait(NetPoller* np, int timeoutMS, Task** tasks, int maxTasks);
+
+	// wake a thread blocked in netpollWait
+	void netpollBreak(NetPoller* np);
+
+	// watch an additional descriptor. When it becomes readable, netpollWait
+	// calls collect to gather the tasks it releases
+	typedef int NetPollCollect(void* context, Task** tasks, int maxTasks);
+	bool netpollAddSource(NetPoller* np, int fd, NetPollCollect* collect, void* context);
+
+	// account for tasks suspended on a source (released tasks are subtracted
+	// by netpollWait)
+	void netpollAddWaiters(NetPoller* np, int delta);
+
+	// io_uring owned by a single worker thread (Linux)
+	struct IoRing;
+
+	// returns nullptr if io_uring is not available
+	IoRing* uringCreate(NetPoller* np);
+	void uringDestroy(IoRing* ring);
+
+	// ring of the calling worker, created on first use
+	IoRing* uringCurrent();
+
+	// submit queued operations to the kernel. Unless force is set, waits for
+	// a full batch or for a few scheduling rounds to pass. Returns true if
+	// anything was submitted
+	bool uringFlush(IoRing* ring, bool force);
+
+	// collect tasks whose operations completed
+	int uringReap(IoRing* ring, Task** tasks, int maxTasks);
+
+	// stackless unit of work. Runs to completion on whichever thread takes
+	// it: on a worker's scheduler fiber, or inline in a task that is
+	// helping out while it waits. Must not suspend
+	struct Job
+	{
+		void (*run)(Job* job);
+		Job* prev;
+		Job* next;
+	};
+
+	// queue a job on the calling worker. Returns false if the calling thread
+	// isn't running a scheduler
+	bool jobPush(Job* job);
+
+	// jobs queued on the calling worker that nobody has taken yet
+	int jobLocalDepth();
+
+	// run one queued job: the newest from the calling worker, or else the
+	// oldest from another worker, trying workers on the same NUMA node
+	// first. Returns false if none were found
+	bool jobRunOne();
+
+	// workers of the calling thread's scheduler (0 if there is none)
+	int jobWorkerCount();
+
+	// CPUs the process may run on, grouped by NUMA node. A single node when
+	// the platform doesn't report any
+	void topologyNodes(std::vector<std::vector<int>>* nodes);
+
+	// pin the calling thread to cpu, saving the CPUs it could run on
+	// before. Returns false if unsupported
+	bool topologyPin(int cpu, std::vector<int>* previous);
+	void topologyRestore(const std::vector<int>& previous);
+
 	TimerContext* timerContextCurrent();
 	void timerContextProcess(TimerContext* ctx);
 
+	// jump a virtual clock to the next timer and wake the tasks due at that
+	// time. Returns false if there are no timers
+	bool timerContextAdvance(TimerContext* ctx);
+
 } // namespace sched
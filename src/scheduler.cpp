@@ -25,6 +25,9 @@
 */
 
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <climits>
 #include <condition_variable>
 #include <functional>
 #include <mutex>
@@ -34,8 +37,20 @@
 #include "sched/fiber.h"
 #include "sched/scheduler.h"
 
+#if defined(__linux__)
+#include <cerrno>
+#include <pthread.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+
 using namespace sched;
 
+typedef std::chrono::high_resolution_clock timer_clock;
+
+static constexpr int c_priorityLevels = 3;
+
 namespace {
 	struct TaskList
 	{
@@ -43,19 +58,141 @@ namespace {
 		Task* last = nullptr;
 	};
 
+	// runnable tasks, one queue per Priority
+	struct RunQueue
+	{
+		TaskList levels[c_priorityLevels];
+
+		// dispatches that passed over a waiting task at each level
+		int bypassed[c_priorityLevels] = {};
+
+		int count = 0;
+	};
+
 	// thread specific scheduler context
 	struct SchedulerThread
 	{
 		Scheduler* scheduler;
 		Fiber* fiber;
 		Task* current;
+		int index;
+
+		// started by SchedulerOptions::maxWorkers, and exiting after
+		// sitting idle
+		bool elastic;
+		bool retired;
+
+		// NUMA node of the CPU the worker is pinned to (-1 when unpinned)
+		int node;
+
 		bool deleteLastFiber;
+		uint32_t dispatches;
+
+		// SchedulerOptions::coopBudget left for the current dispatch.
+		// Zeroed by the preemption signal
+		std::atomic<int> budget;
+
+		// odd while a task is switched in. Watched by the preemption monitor
+		std::atomic<uint32_t> switches;
+
+		// created on first use by uringCurrent. Not retried once creating
+		// it failed (e.g. RLIMIT_MEMLOCK)
+		IoRing* ring;
+		bool ringFailed;
+
+		// group of the last dispatched task, charged for the dispatch the
+		// next time the worker takes runlistLock
+		TaskGroup* chargeGroup;
+		timer_clock::rep dispatchStart;
+		bool chargeExited;
+
+		// Task::pushes of the last dispatched task when it was dispatched
+		uint32_t dispatchPushes;
+
+		// stack profiling details of the exited task (when deleteLastFiber)
+		const char* lastName;
+		bool lastStackPainted;
+
+		// bounds of the thread's own stack, which the scheduler fiber runs
+		// on. Set when the preemption monitor watches this worker
+		bool preemptAttached;
+		uintptr_t stackLow;
+		uintptr_t stackHigh;
+
+#if defined(__linux__)
+		// owned by the preemption monitor
+		pthread_t nativeThread;
+		uint32_t preemptSeen;
+		timer_clock::time_point preemptSince;
+
+		// set by the monitor right before it signals the worker, so the
+		// handler can tell its SIGURG from anybody else's
+		std::atomic<bool> preemptPending;
+#endif
+	};
+
+	// SchedulerOptions::preemptSliceMS state. Signals workers whose task
+	// has been switched in for longer than the slice
+	struct PreemptMonitor
+	{
+		std::mutex lock;
+		std::condition_variable cond;
+		bool stop = false;
+		std::vector<SchedulerThread*> workers;
+		std::thread thread;
+	};
+
+	// stackless jobs pushed by a single worker. The owner works from the
+	// back, thieves from the front
+	struct JobQueue
+	{
+		std::mutex lock;
+		Job* front = nullptr;
+		Job* back = nullptr;
+		std::atomic<int> depth = ATOMIC_VAR_INIT(0);
+
+		// NUMA node of the owning worker (-1 when unpinned)
+		std::atomic<int> node = ATOMIC_VAR_INIT(-1);
+	};
+
+	// live tasks spawned from a single worker. Each worker registers into
+	// its own shard, so the lock is only contended by dumpTasks and by
+	// tasks exiting on a different worker
+	struct RegistryShard
+	{
+		std::mutex lock;
+		Task* head = nullptr;
 	};
 } // namespace `anonymous'
 
+static constexpr int c_registryShards = 16;
+
+// workers beyond this share job queues
+static constexpr int c_jobQueues = 64;
+
+// a waiting level is dispatched ahead of higher ones after being passed over
+// this many times
+static constexpr int c_agingLimit[c_priorityLevels] = {0, 8, 32};
+
+// a group of weight w advances its pass by c_strideScale / w per nanosecond
+// its tasks run
+static constexpr uint64_t c_strideScale = 1 << 16;
+static constexpr int c_maxGroupWeight = 1 << 16;
+
+// pinned workers look this far into a run queue level for a task that last
+// ran on their node. A task at the front is passed over at most
+// c_nodeMaxSkips times
+static constexpr int c_nodeScan = 4;
+static constexpr int c_nodeMaxSkips = 4;
+
+// busy workers check for ready descriptors every c_netpollInterval dispatches
+static constexpr uint32_t c_netpollInterval = 61;
+static constexpr int c_netpollBatch = 128;
+
 // task context
 struct sched::Task
 {
+	Scheduler* scheduler;
 	SchedulerThread* thread; // owned by Scheduler
 	Fiber* fiber;
 	Task* next; // owned and initialized by TaskList
@@ -64,6 +201,64 @@ struct sched::Task
 	void* unlockContext = nullptr;
 
 	std::mutex runLock;
+
+	// debug state reported by dumpTasks
+	const char* name = nullptr;
+	Priority priority = Priority::Normal;
+	TaskGroup* group;
+	timer_clock::rep deadline = 0;
+
+	// holds one of its group's TaskGroupOptions::maxRunnable slots, and
+	// times queued while holding it (owned by runlistLock)
+	bool admitted = false;
+	uint32_t pushes = 0;
+
+	// PreemptibleScope nesting
+	std::atomic<int> preemptDepth = ATOMIC_VAR_INIT(0);
+
+	// NUMA node the task last ran on (-1 for any), and how often it was
+	// passed over for a task of another node (owned by runlistLock)
+	int node = -1;
+	int nodeSkips = 0;
+	std::atomic<TaskState> state = ATOMIC_VAR_INIT(TaskState::Runnable);
+	std::atomic<int> worker = ATOMIC_VAR_INIT(-1);
+	std::atomic<const void*> waitObject = ATOMIC_VAR_INIT(nullptr);
+	std::atomic<timer_clock::rep> wakeTime = ATOMIC_VAR_INIT(0);
+
+	bool stackPainted = false;
+
+	// owned by the task registry
+	RegistryShard* registry = nullptr;
+	Task* registryPrev;
+	Task* registryNext;
+};
+
+// tasks sharing a weighted share of the workers
+struct sched::TaskGroup
+{
+	Scheduler* scheduler;
+	uint64_t stride;
+	int maxRunnable;
+
+	// owned by runlistLock
+	RunQueue runqueue;
+
+	// live tasks, and dispatches not yet charged to the group
+	int tasks = 0;
+	int running = 0;
+
+	// tasks holding a maxRunnable slot, and tasks made runnable past the
+	// cap, waiting for a slot in order
+	int runnable = 0;
+	TaskList held;
+
+	// virtual time: advances by stride for each nanosecond of run time.
+	// Compared with wrap-around
+	uint64_t pass = 0;
+
+	// groups with queued tasks
+	TaskGroup* activePrev;
+	TaskGroup* activeNext;
 };
 
 // scheduler data shared among all threads
@@ -71,13 +266,103 @@ struct sched::Scheduler
 {
 	std::mutex runlistLock;
 	std::condition_variable runlistCond;
-	TaskList runlist;
+
+	// runnable tasks, queued per group (owned by runlistLock)
+	TaskGroup defaultGroup;
+	TaskGroup* activeGroups = nullptr;
+	uint64_t groupPass = 0;
+	int createdGroups = 0;
+	PriorityStats priorityStats[c_priorityLevels] = {};
+
+	// runnable tasks with a deadline, earliest first. Dispatched ahead of
+	// every group (owned by runlistLock)
+	std::vector<Task*> deadlineHeap;
+	uint64_t lateDispatches = 0;
+
+	std::atomic<uint64_t> deadlinesMet = ATOMIC_VAR_INIT(0);
+	std::atomic<uint64_t> deadlinesMissed = ATOMIC_VAR_INIT(0);
+	std::atomic<uint64_t> coopYields = ATOMIC_VAR_INIT(0);
+	std::atomic<uint64_t> preemptions = ATOMIC_VAR_INIT(0);
+
+	PreemptMonitor* preempt = nullptr;
+
+	// workers blocked on runlistCond (owned by runlistLock)
+	int idleWorkers = 0;
+
+	// running workers, and SchedulerOptions::maxWorkers state (owned by
+	// runlistLock; workers is also read without it). Elastic threads are
+	// detached; destroyScheduler waits on elasticCond for them to exit
+	std::atomic<int> workers = ATOMIC_VAR_INIT(0);
+	bool growing = false;
+	int elasticThreads = 0;
+	uint64_t workersStarted = 0;
+	uint64_t workersRetired = 0;
+	std::condition_variable elasticCond;
+
+	// run context of elastic workers, which outlive the run that started
+	// them. They keep running while the context of any thread in run
+	// does. Taken after runlistLock
+	struct ElasticContext final : RunContext
+	{
+		virtual bool running() const override
+		{
+			std::unique_lock<std::mutex> lock(contextsLock);
+			for (const RunContext* context : contexts)
+			{
+				if (context->running())
+				{
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		mutable std::mutex contextsLock;
+		std::vector<const RunContext*> contexts;
+	} elasticContext;
+
+	// a worker is blocked in netpollWait (owned by runlistLock)
+	bool netpolling = false;
+	NetPoller* netpoller;
+
+	// tasks woken by threads outside the scheduler, newest first. Pushed
+	// without the lock; drained by workers into the runlist
+	std::atomic<Task*> inbox = ATOMIC_VAR_INIT(nullptr);
+
+	// workers blocked on runlistCond or in netpollWait. Lets threads pushing
+	// to the inbox skip the lock unless somebody has to be woken
+	std::atomic<int> parkedWorkers = ATOMIC_VAR_INIT(0);
+
+	// stackless jobs, queued per worker
+	JobQueue jobQueues[c_jobQueues];
+	std::atomic<int> queuedJobs = ATOMIC_VAR_INIT(0);
+
+	// per-worker io_uring instances, destroyed with the scheduler
+	std::mutex ringsLock;
+	std::vector<IoRing*> rings;
 
 	FiberFactory* factory;
+	SchedulerOptions options;
+	std::atomic<int> nextWorkerIndex = ATOMIC_VAR_INIT(0);
+
+	// SchedulerOptions::pinWorkers placement, and the workers pinned to
+	// each CPU (owned by runlistLock)
+	std::vector<int> workerCpus;
+	std::vector<int> workerNodes;
+	std::vector<int> workerCpuUsers;
+	int nodeCount = 1;
+
+	// SchedulerOptions::deterministic state
+	uint64_t random;
+	TimerContext* virtualTimers = nullptr;
+
+	RegistryShard registry[c_registryShards];
+	StackProfile stacks;
 };
 
 static std::once_flag g_timersRunning;
-static TimerContext g_timers;
+static TimerContext* g_timers;
 static thread_local SchedulerThread* g_currentThreadScheduler;
 
 static bool tasklistEmpty(const TaskList* tl)
@@ -85,6 +370,34 @@ static bool tasklistEmpty(const TaskList* tl)
 	return tl->front == nullptr;
 }
 
+// remove the task at the specified position
+static Task* tasklistRemoveAt(TaskList* tl, int index)
+{
+	Task* prev = nullptr;
+	Task* t = tl->front;
+	for (; index > 0; --index)
+	{
+		prev = t;
+		t = t->next;
+	}
+
+	if (prev)
+	{
+		prev->next = t->next;
+	}
+	else
+	{
+		tl->front = t->next;
+	}
+
+	if (tl->last == t)
+	{
+		tl->last = prev;
+	}
+
+	return t;
+}
+
 static Task* tasklistPop(TaskList* tl)
 {
 	Task* t = tl->front;
@@ -114,8 +427,80 @@ static void tasklistPush(TaskList* tl, Task* t)
 	t->next = nullptr;
 }
 
+static void runqueuePush(RunQueue* rq, Task* t, PriorityStats* stats)
+{
+	const int level = static_cast<int>(t->priority);
+	tasklistPush(&rq->levels[level], t);
+	++rq->count;
+	++stats[level].queued;
+}
+
+// pick the level to dispatch from: the highest waiting level, unless a lower
+// one has been passed over often enough to age ahead of it
+static int runqueueSelect(RunQueue* rq, PriorityStats* stats)
+{
+	int level = 0;
+	while (level != c_priorityLevels && tasklistEmpty(&rq->levels[level]))
+	{
+		++level;
+	}
+
+	if (level == c_priorityLevels)
+	{
+		return -1;
+	}
+
+	for (int ii = c_priorityLevels - 1; ii > level; --ii)
+	{
+		if (!tasklistEmpty(&rq->levels[ii]) && rq->bypassed[ii] >= c_agingLimit[ii])
+		{
+			++stats[ii].aged;
+			return ii;
+		}
+	}
+
+	return level;
+}
+
+// add a task to the registry shard of the calling worker
+static void registryAdd(Scheduler* s, Task* t)
+{
+	const int index = g_currentThreadScheduler ? g_currentThreadScheduler->index + 1 : 0;
+	RegistryShard* shard = &s->registry[index % c_registryShards];
+
+	std::unique_lock<std::mutex> lock(shard->lock);
+	t->registry = shard;
+	t->registryPrev = nullptr;
+	t->registryNext = shard->head;
+	if (shard->head)
+	{
+		shard->head->registryPrev = t;
+	}
+	shard->head = t;
+}
+
+static void registryRemove(Task* t)
+{
+	RegistryShard* shard = t->registry;
+
+	std::unique_lock<std::mutex> lock(shard->lock);
+	if (t->registryPrev)
+	{
+		t->registryPrev->registryNext = t->registryNext;
+	}
+	else
+	{
+		shard->head = t->registryNext;
+	}
+
+	if (t->registryNext)
+	{
+		t->registryNext->registryPrev = t->registryPrev;
+	}
+}
+
 // create a new task, but do not schedule it
-static Task* createTask(FiberFactory* factory, Fiber* current, std::function<void()> entry, int stackSize)
+static Task* createTask(FiberFactory* factory, Fiber* current, std::function<void()> entry, int stackSize, bool paintStack)
 {
 	struct Context
 	{
@@ -123,12 +508,14 @@ static Task* createTask(FiberFactory* factory, Fiber* current, std::function<voi
 		FiberFactory* factory;
 		Fiber* callingFiber;
 		std::function<void()> entry;
+		bool paintStack;
 	};
 
 	Context ctx;
 	ctx.factory = factory;
 	ctx.callingFiber = current;
 	ctx.entry = std::move(entry);
+	ctx.paintStack = paintStack;
 
 	Fiber* fiber = factory->create([](Fiber* self, void* context) -> Fiber* {
 		Context* ctx = static_cast<Context*>(context);
@@ -137,6 +524,12 @@ static Task* createTask(FiberFactory* factory, Fiber* current, std::function<voi
 		task.fiber = self;
 		std::function<void()> taskEntry = std::move(ctx->entry);
 
+		if (ctx->paintStack)
+		{
+			stackPaint(ctx->factory, self);
+			task.stackPainted = true;
+		}
+
 		// return controller back to createTask
 		ctx->result = &task;
 		ctx->factory->switchTo(self, ctx->callingFiber);
@@ -146,8 +539,22 @@ static Task* createTask(FiberFactory* factory, Fiber* current, std::function<voi
 		// run the task
 		taskEntry();
 
+		if (0 != task.deadline)
+		{
+			Scheduler* s = task.scheduler;
+			const bool met = timer_clock::now().time_since_epoch().count() <= task.deadline;
+			(met ? s->deadlinesMet : s->deadlinesMissed).fetch_add(1, std::memory_order_relaxed);
+		}
+
+		if (task.registry)
+		{
+			registryRemove(&task);
+		}
+
 		// flag ourselves for deletion and return control to our scheduler thread
 		task.thread->deleteLastFiber = true;
+		task.thread->lastName = task.name;
+		task.thread->lastStackPainted = task.stackPainted;
 		return task.thread->fiber;
 	}, &ctx, stackSize);
 
@@ -155,160 +562,1278 @@ static Task* createTask(FiberFactory* factory, Fiber* current, std::function<voi
 	return ctx.result;
 }
 
-// atomically wait for a runnable task
-static Task* waitForTask(Scheduler* s, const RunContext* runContext)
+// xorshift64*
+static uint64_t nextRandom(uint64_t* state)
 {
-	std::unique_lock<std::mutex> lock(s->runlistLock);
-	while (tasklistEmpty(&s->runlist) && runContext->running())
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545f4914f6cdd1dull;
+}
+
+// pick a pseudo-random runnable task
+static Task* tasklistPopRandom(TaskList* tl, uint64_t* random)
+{
+	int count = 0;
+	for (Task* t = tl->front; t; t = t->next)
 	{
-		s->runlistCond.wait(lock);
+		++count;
 	}
 
-	return tasklistPop(&s->runlist);
+	if (0 == count)
+	{
+		return nullptr;
+	}
+
+	return tasklistRemoveAt(tl, static_cast<int>(nextRandom(random) % static_cast<uint64_t>(count)));
 }
 
-// main scheduler routine
-static void schedRunFiber(Scheduler* s, Fiber* fiber, const RunContext* runContext)
+// take the first of the leading tasks in the list that last ran on node
+static Task* tasklistPopNear(TaskList* tl, int node)
 {
-	SchedulerThread thread;
-	thread.fiber = fiber;
-	thread.scheduler = s;
-	thread.current = nullptr;
-
-	g_currentThreadScheduler = &thread;
+	Task* t = tl->front;
+	if (t->node == node || t->node < 0 || t->nodeSkips >= c_nodeMaxSkips)
+	{
+		return tasklistPop(tl);
+	}
 
-	for ( ; runContext->running(); )
+	int index = 1;
+	for (Task* near = t->next; near && index != c_nodeScan; near = near->next, ++index)
 	{
-		Task* const task = waitForTask(s, runContext);
-		if (!task)
+		if (near->node == node)
 		{
-			continue;
+			++t->nodeSkips;
+			return tasklistRemoveAt(tl, index);
 		}
+	}
 
-		Fiber* const taskFiber = task->fiber;
-		task->thread = &thread;
-
-		thread.current = task;
-		thread.deleteLastFiber = false;
+	return tasklistPop(tl);
+}
 
-		task->runLock.lock();
-		s->factory->switchTo(fiber, taskFiber);
+// take the next task from the run queue. Tasks within the selected level
+// are picked pseudo-randomly when random is provided, otherwise in order
+// with a preference for tasks that last ran on node (when not -1)
+static Task* runqueuePop(RunQueue* rq, uint64_t* random, PriorityStats* stats, int node)
+{
+	const int level = runqueueSelect(rq, stats);
+	if (level < 0)
+	{
+		return nullptr;
+	}
 
-		// was a delete requested
-		// if so: task has gone out of scope and is no longer valid
-		if (thread.deleteLastFiber)
+	for (int ii = level + 1; ii != c_priorityLevels; ++ii)
+	{
+		if (!tasklistEmpty(&rq->levels[ii]))
 		{
-			s->factory->release(taskFiber);
+			++rq->bypassed[ii];
 		}
-		else
-		{
-			void (*unlock)(void*) = task->unlock;
-			void* unlockContext = task->unlockContext;
-			task->unlock = nullptr;
+	}
 
-			// let other threads scheduler this task
-			task->runLock.unlock();
+	rq->bypassed[level] = 0;
+	--rq->count;
+	++stats[level].dispatched;
+	--stats[level].queued;
 
-			// if we have a post unlock context, invoke it now
-			if (unlock)
-			{
-				(unlock)(unlockContext);
-			}
-		}
+	if (random)
+	{
+		return tasklistPopRandom(&rq->levels[level], random);
+	}
+	else if (node >= 0)
+	{
+		return tasklistPopNear(&rq->levels[level], node);
 	}
 
-	g_currentThreadScheduler = nullptr;
+	return tasklistPop(&rq->levels[level]);
+}
 
-	// wake up anyone waiting
-	s->runlistCond.notify_all();
+// order deadlineHeap as a min-heap
+static bool deadlineLater(const Task* a, const Task* b)
+{
+	return a->deadline > b->deadline;
 }
 
-Scheduler* sched::createScheduler(FiberFactory* factory)
+// queue a task on its group, making the group active if it was idle. A
+// group returning from idle doesn't get credit for the time it sat out.
+// Tasks past the group's maxRunnable are held until a slot frees
+static void runlistPushWithLock(Scheduler* s, Task* t)
 {
-	// ensure timer context is running
-	std::call_once(g_timersRunning, []() {
-		std::thread(timerContextProcess, &g_timers).detach();
-	});
+	TaskGroup* g = t->group;
+	if (!t->admitted)
+	{
+		if (g->maxRunnable > 0 && g->runnable >= g->maxRunnable)
+		{
+			tasklistPush(&g->held, t);
+			return;
+		}
 
-	Scheduler* scheduler = new Scheduler;
-	scheduler->factory = factory;
+		t->admitted = true;
+		++g->runnable;
+	}
 
-	return scheduler;
+	++t->pushes;
+	if (0 != t->deadline)
+	{
+		s->deadlineHeap.push_back(t);
+		std::push_heap(s->deadlineHeap.begin(), s->deadlineHeap.end(), deadlineLater);
+		++s->priorityStats[static_cast<int>(t->priority)].queued;
+		return;
+	}
+
+	runqueuePush(&g->runqueue, t, s->priorityStats);
+
+	if (1 == g->runqueue.count)
+	{
+		if (static_cast<int64_t>(g->pass - s->groupPass) < 0)
+		{
+			g->pass = s->groupPass;
+		}
+
+		g->activePrev = nullptr;
+		g->activeNext = s->activeGroups;
+		if (s->activeGroups)
+		{
+			s->activeGroups->activePrev = g;
+		}
+		s->activeGroups = g;
+	}
 }
 
-void sched::destroyScheduler(Scheduler* scheduler)
+// pick the group to dispatch from: the active group furthest behind in
+// virtual time
+static TaskGroup* runlistSelect(Scheduler* s)
 {
-	delete(scheduler);
+	TaskGroup* best = nullptr;
+	for (TaskGroup* g = s->activeGroups; g; g = g->activeNext)
+	{
+		if (!best || static_cast<int64_t>(g->pass - best->pass) < 0)
+		{
+			best = g;
+		}
+	}
+
+	return best;
 }
 
-FiberFactory* sched::getFiberFactory(Scheduler* scheduler)
+// account a dispatch to the task's group. Run time only matters once groups
+// compete
+static void groupDispatchWithLock(Scheduler* s, SchedulerThread* thread, Task* t)
 {
-	return scheduler->factory;
+	TaskGroup* g = t->group;
+	++g->running;
+
+	thread->chargeGroup = g;
+	thread->dispatchPushes = t->pushes;
+	thread->chargeExited = false;
+	thread->dispatchStart = 0;
+	if (s->createdGroups > 0 && !s->options.deterministic)
+	{
+		thread->dispatchStart = timer_clock::now().time_since_epoch().count();
+	}
 }
 
-void sched::run(Scheduler* scheduler, const RunContext* runContext)
+// take the task with the earliest deadline. It still counts against its
+// group's run time and maxRunnable, but ignores the group's share
+static Task* deadlinePopWithLock(Scheduler* s, SchedulerThread* thread)
 {
-	SchedulerThread* previousThread = g_currentThreadScheduler;
-	Fiber* fiber = previousThread ? previousThread->fiber : scheduler->factory->fromCurrentThread();
+	std::pop_heap(s->deadlineHeap.begin(), s->deadlineHeap.end(), deadlineLater);
+	Task* t = s->deadlineHeap.back();
+	s->deadlineHeap.pop_back();
 
-	schedRunFiber(scheduler, fiber, runContext);
-	g_currentThreadScheduler = previousThread;
+	PriorityStats* stats = &s->priorityStats[static_cast<int>(t->priority)];
+	++stats->dispatched;
+	--stats->queued;
 
-	if (!previousThread)
+	if (timer_clock::now().time_since_epoch().count() > t->deadline)
 	{
-		scheduler->factory->releaseCurrentThread(fiber);
+		++s->lateDispatches;
 	}
+
+	groupDispatchWithLock(s, thread, t);
+	return t;
 }
 
-void sched::runFunction(FiberFactory* factory, int nthreads, std::function<void(sched::Scheduler* scheduler)> entry)
+static Task* runlistPopWithLock(Scheduler* s, SchedulerThread* thread, TaskGroup* g)
 {
-	struct Context : RunContext
+	const int node = s->nodeCount > 1 ? thread->node : -1;
+	Task* t = runqueuePop(&g->runqueue, s->options.deterministic ? &s->random : nullptr, s->priorityStats, node);
+
+	s->groupPass = g->pass;
+	groupDispatchWithLock(s, thread, t);
+
+	if (0 == g->runqueue.count)
 	{
-		virtual bool running() const override
+		if (g->activePrev)
 		{
-			return run;
+			g->activePrev->activeNext = g->activeNext;
+		}
+		else
+		{
+			s->activeGroups = g->activeNext;
 		}
 
-		bool run = true;
-	};
-
-	Context ctx;
-
-	Scheduler* scheduler = createScheduler(factory);
-
-	std::vector<std::thread> threads(std::max(1, nthreads-1));
+		if (g->activeNext)
+		{
+			g->activeNext->activePrev = g->activePrev;
+		}
+	}
 
-	sched::spawn(scheduler, [&entry, scheduler, &ctx, &threads]() {
+	return t;
+}
 
-		// start worker threads
-		for (auto& thr : threads)
+// a task switched out. Unless it was requeued since its dispatch (even if
+// already taken by another worker), it gives up its maxRunnable slot to the
+// next held task. t is nullptr if it exited
+static void groupReleaseWithLock(Scheduler* s, SchedulerThread* thread, TaskGroup* g, Task* t)
+{
+	if (t)
+	{
+		if (t->pushes != thread->dispatchPushes)
 		{
-			thr = std::thread(sched::run, scheduler, &ctx);
+			return;
 		}
 
-		entry(scheduler);
-		ctx.run = false;
-	});
-
-	run(scheduler, &ctx);
+		t->admitted = false;
+	}
 
-	// wait for worker threads to terminate
-	for (auto& thr : threads)
+	--g->runnable;
+	if (!tasklistEmpty(&g->held))
 	{
-		thr.join();
+		runlistPushWithLock(s, tasklistPop(&g->held));
 	}
-
-	destroyScheduler(scheduler);
 }
 
-static void suspendTask(Task* t)
+// charge the group of the worker's last dispatch for its run time. Deferred
+// until the worker next takes runlistLock, so dispatches don't pay for an
+// extra lock. The group may be destroyed once this returns
+static void groupChargeWithLock(SchedulerThread* thread)
 {
-	FiberFactory* factory = g_currentThreadScheduler->scheduler->factory;
-	factory->switchTo(t->fiber, g_currentThreadScheduler->fiber);
-}
+	TaskGroup* g = thread->chargeGroup;
+	if (!g)
+	{
+		return;
+	}
 
-Task* sched::spawn(Scheduler* scheduler, std::function<void()> entry, int stackSize)
-{
+	uint64_t elapsed = 1;
+	if (0 != thread->dispatchStart)
+	{
+		const timer_clock::rep now = timer_clock::now().time_since_epoch().count();
+		elapsed = static_cast<uint64_t>(std::max<timer_clock::rep>(now - thread->dispatchStart, 1));
+	}
+
+	g->pass += g->stride * elapsed;
+	--g->running;
+	if (thread->chargeExited)
+	{
+		--g->tasks;
+	}
+
+	thread->chargeGroup = nullptr;
+}
+
+static void schedRunFiber(Scheduler* s, Fiber* fiber, bool fiberIsThread, const RunContext* runContext, bool elastic);
+
+// SchedulerOptions::maxWorkers: claim the start of another worker if tasks
+// are piling up with every worker busy. One starts at a time
+static bool elasticGrowWithLock(Scheduler* s)
+{
+	if (!s->elasticContext.running() || s->growing || s->idleWorkers > 0 || s->workers >= s->options.maxWorkers || s->options.deterministic)
+	{
+		return false;
+	}
+
+	int runnable = 0;
+	for (const PriorityStats& stats : s->priorityStats)
+	{
+		runnable += stats.queued;
+	}
+
+	if (runnable < s->options.growBacklog)
+	{
+		return false;
+	}
+
+	s->growing = true;
+	++s->elasticThreads;
+	++s->workersStarted;
+	return true;
+}
+
+static void elasticStart(Scheduler* s)
+{
+	std::thread([s]() {
+		Fiber* fiber = s->factory->fromCurrentThread();
+		schedRunFiber(s, fiber, true, &s->elasticContext, true);
+		s->factory->releaseCurrentThread(fiber);
+
+		std::unique_lock<std::mutex> lock(s->runlistLock);
+		--s->elasticThreads;
+		s->elasticCond.notify_all();
+	}).detach();
+}
+
+// make ntasks tasks, chained through next, runnable. Wakes an idle worker
+// for each, or interrupts the poller if every worker is busy or blocked in
+// it
+static void runlistPush(Scheduler* s, Task* tasks, int ntasks, bool spawned)
+{
+	SchedulerThread* thread = g_currentThreadScheduler;
+
+	int idle;
+	bool netpolling;
+	bool grow = false;
+	{
+		std::unique_lock<std::mutex> lock(s->runlistLock);
+		for (int ii = 0; ii != ntasks; ++ii)
+		{
+			Task* t = tasks;
+			tasks = t->next;
+
+			runlistPushWithLock(s, t);
+			if (spawned)
+			{
+				++t->group->tasks;
+				++s->priorityStats[static_cast<int>(t->priority)].spawned;
+			}
+		}
+
+		idle = std::min(s->idleWorkers, ntasks);
+		netpolling = s->netpolling;
+
+		if (s->options.maxWorkers > 0 && thread && thread->scheduler == s)
+		{
+			grow = elasticGrowWithLock(s);
+		}
+	}
+
+	if (idle)
+	{
+		for (int ii = 0; ii != idle; ++ii)
+		{
+			s->runlistCond.notify_one();
+		}
+	}
+	else if (netpolling)
+	{
+		netpollBreak(s->netpoller);
+	}
+
+	if (grow)
+	{
+		elasticStart(s);
+	}
+}
+
+// wake a parked worker to pick up work published without runlistLock.
+// Parking workers check for such work after announcing themselves, so
+// either they see the work or we see them
+static void doorbell(Scheduler* s)
+{
+	if (0 == s->parkedWorkers.load())
+	{
+		return;
+	}
+
+	bool idle;
+	bool netpolling;
+	{
+		std::unique_lock<std::mutex> lock(s->runlistLock);
+		idle = s->idleWorkers > 0;
+		netpolling = s->netpolling;
+	}
+
+	if (idle)
+	{
+		s->runlistCond.notify_one();
+	}
+	else if (netpolling)
+	{
+		netpollBreak(s->netpoller);
+	}
+}
+
+// wake tasks from a thread that isn't one of the scheduler's workers. The
+// tasks are chained through next from front to last, newest first
+static void inboxPush(Scheduler* s, Task* front, Task* last)
+{
+	Task* head = s->inbox.load(std::memory_order_relaxed);
+	do
+	{
+		last->next = head;
+	} while (!s->inbox.compare_exchange_weak(head, front));
+
+	doorbell(s);
+}
+
+// move tasks from the inbox to the runlist, waking idle workers to help run
+// them. Returns true if any tasks were moved
+static bool inboxDrainWithLock(Scheduler* s)
+{
+	if (!s->inbox.load())
+	{
+		return false;
+	}
+
+	// restore the order the tasks were woken in
+	Task* reversed = nullptr;
+	for (Task* t = s->inbox.exchange(nullptr); t; )
+	{
+		Task* next = t->next;
+		t->next = reversed;
+		reversed = t;
+		t = next;
+	}
+
+	int ntasks = 0;
+	while (reversed)
+	{
+		Task* next = reversed->next;
+		runlistPushWithLock(s, reversed);
+		reversed = next;
+		++ntasks;
+	}
+
+	for (int ii = 1; ii < ntasks && ii <= s->idleWorkers; ++ii)
+	{
+		s->runlistCond.notify_one();
+	}
+
+	return true;
+}
+
+// queue tasks returned by the poller and wake idle workers to run them. The
+// calling worker is expected to run one of them
+static void runlistPushPolledWithLock(Scheduler* s, Task** tasks, int ntasks)
+{
+	for (int ii = 0; ii != ntasks; ++ii)
+	{
+		runlistPushWithLock(s, tasks[ii]);
+	}
+
+	for (int ii = 1; ii < ntasks && ii <= s->idleWorkers; ++ii)
+	{
+		s->runlistCond.notify_one();
+	}
+}
+
+// non-blocking check for ready descriptors
+static void netpollPoll(Scheduler* s)
+{
+	if (!netpollWaiting(s->netpoller))
+	{
+		return;
+	}
+
+	Task* ready[c_netpollBatch];
+	const int nready = netpollWait(s->netpoller, 0, ready, c_netpollBatch);
+	if (nready > 0)
+	{
+		std::unique_lock<std::mutex> lock(s->runlistLock);
+		runlistPushPolledWithLock(s, ready, nready);
+	}
+}
+
+// submit this worker's queued io_uring operations and queue the tasks whose
+// operations have completed
+static void uringPoll(Scheduler* s, SchedulerThread* thread)
+{
+	if (!thread->ring)
+	{
+		return;
+	}
+
+	uringFlush(thread->ring, false);
+
+	Task* ready[c_netpollBatch];
+	const int nready = uringReap(thread->ring, ready, c_netpollBatch);
+	if (nready > 0)
+	{
+		netpollAddWaiters(s->netpoller, -nready);
+
+		std::unique_lock<std::mutex> lock(s->runlistLock);
+		runlistPushPolledWithLock(s, ready, nready);
+	}
+}
+
+// atomically wait for a runnable task
+static Task* waitForTask(Scheduler* s, SchedulerThread* thread, const RunContext* runContext)
+{
+	std::unique_lock<std::mutex> lock(s->runlistLock);
+	groupChargeWithLock(thread);
+	inboxDrainWithLock(s);
+
+	// queued jobs are run by the caller
+	TaskGroup* group = nullptr;
+	bool idleTimeout = false;
+	while (s->deadlineHeap.empty() && !(group = runlistSelect(s)) && s->queuedJobs.load(std::memory_order_relaxed) <= 0 && runContext->running())
+	{
+		// elastic workers leave once they have sat idle for a while. One
+		// with an io_uring stays, as only it submits to the ring
+		if (idleTimeout)
+		{
+			thread->retired = true;
+			++s->workersRetired;
+			return nullptr;
+		}
+
+		// don't sit on a partial batch of io_uring operations
+		if (thread->ring)
+		{
+			lock.unlock();
+			const bool submitted = uringFlush(thread->ring, true);
+			lock.lock();
+
+			if (submitted)
+			{
+				continue;
+			}
+		}
+
+		// nothing can run until the next timer fires. Skip ahead to it
+		if (s->virtualTimers)
+		{
+			lock.unlock();
+			const bool advanced = timerContextAdvance(s->virtualTimers);
+			lock.lock();
+
+			if (advanced)
+			{
+				continue;
+			}
+		}
+
+		// nothing to run: block in the poller if tasks are waiting on
+		// descriptors and no other worker already is
+		if (!s->netpolling && netpollWaiting(s->netpoller))
+		{
+			s->netpolling = true;
+			s->parkedWorkers.fetch_add(1);
+
+			if (!inboxDrainWithLock(s) && s->queuedJobs.load() <= 0)
+			{
+				lock.unlock();
+
+				Task* ready[c_netpollBatch];
+				const int nready = netpollWait(s->netpoller, -1, ready, c_netpollBatch);
+
+				lock.lock();
+				runlistPushPolledWithLock(s, ready, nready);
+			}
+
+			s->parkedWorkers.fetch_sub(1);
+			s->netpolling = false;
+			continue;
+		}
+
+		++s->idleWorkers;
+		s->parkedWorkers.fetch_add(1);
+
+		if (!inboxDrainWithLock(s) && s->queuedJobs.load() <= 0)
+		{
+			if (thread->elastic && !thread->ring)
+			{
+				const std::chrono::milliseconds idle(std::max(s->options.workerIdleMS, 0));
+				idleTimeout = std::cv_status::timeout == s->runlistCond.wait_for(lock, idle);
+			}
+			else
+			{
+				s->runlistCond.wait(lock);
+			}
+		}
+
+		s->parkedWorkers.fetch_sub(1);
+		--s->idleWorkers;
+	}
+
+	if (!s->deadlineHeap.empty())
+	{
+		return deadlinePopWithLock(s, thread);
+	}
+
+	if (!group)
+	{
+		return nullptr;
+	}
+
+	return runlistPopWithLock(s, thread, group);
+}
+
+#if defined(__linux__)
+
+// SIGURG is ignored by default and rarely used, so it can be borrowed. The
+// application's handler, if any, keeps getting the SIGURGs that aren't ours
+// (e.g. TCP out-of-band data)
+static constexpr int c_preemptSignal = SIGURG;
+
+// handler installed while any scheduler uses preemption (owned by lock)
+static struct
+{
+	std::mutex lock;
+	int users = 0;
+	struct sigaction previous;
+} g_preemptHandler;
+
+static void preemptChain(int signo, siginfo_t* info, void* context)
+{
+	const struct sigaction& previous = g_preemptHandler.previous;
+	if (previous.sa_flags & SA_SIGINFO)
+	{
+		previous.sa_sigaction(signo, info, context);
+	}
+	else if (previous.sa_handler != SIG_IGN && previous.sa_handler != SIG_DFL)
+	{
+		previous.sa_handler(signo);
+	}
+}
+
+// errno lives at a per-thread address, which the compiler may keep in a
+// register across a fiber switch. Out of line, it is looked up afresh
+static __attribute__((noinline)) void preemptSetErrno(int value)
+{
+	errno = value;
+}
+
+// interrupt the running task. Inside a PreemptibleScope it is requeued right
+// here, on its own stack; elsewhere its next sched primitive yields
+static void preemptSignal(int signo, siginfo_t* info, void* context)
+{
+	const int savedErrno = errno;
+
+	SchedulerThread* thread = g_currentThreadScheduler;
+	const bool ours = SI_TKILL == info->si_code && getpid() == info->si_pid
+		&& thread && thread->preemptPending.exchange(false);
+	if (!ours)
+	{
+		errno = savedErrno;
+		preemptChain(signo, info, context);
+		return;
+	}
+
+	// only task code can be interrupted: not the scheduler fiber, which
+	// runs on the thread's own stack
+	const uintptr_t sp = reinterpret_cast<uintptr_t>(&thread);
+	if (thread->preemptAttached && thread->current && (sp < thread->stackLow || sp >= thread->stackHigh))
+	{
+		Task* task = thread->current;
+
+		// claimed before anything else, so a nested signal backs off
+		const int depth = task->preemptDepth.exchange(0);
+		if (0 == depth)
+		{
+			thread->budget.store(0, std::memory_order_relaxed);
+		}
+		else
+		{
+			thread->scheduler->preemptions.fetch_add(1, std::memory_order_relaxed);
+
+			wake(task);
+			thread->scheduler->factory->switchTo(task->fiber, thread->fiber);
+
+			// possibly resumed on another worker. Returning from the handler
+			// restores the signal mask and alternate signal stack saved for
+			// the original thread, so replace them with this thread's
+			ucontext_t* uc = static_cast<ucontext_t*>(context);
+			pthread_sigmask(SIG_SETMASK, nullptr, &uc->uc_sigmask);
+			sigaltstack(nullptr, &uc->uc_stack);
+
+			task->preemptDepth.store(depth);
+
+			// the task's errno, now on this thread's
+			preemptSetErrno(savedErrno);
+			return;
+		}
+	}
+
+	errno = savedErrno;
+}
+
+static void preemptMonitorRun(Scheduler* s)
+{
+	PreemptMonitor* m = s->preempt;
+	const timer_clock::duration slice = std::chrono::milliseconds(s->options.preemptSliceMS);
+	const timer_clock::duration interval = std::max<timer_clock::duration>(slice / 2, std::chrono::milliseconds(1));
+
+	std::unique_lock<std::mutex> lock(m->lock);
+	while (!m->stop)
+	{
+		m->cond.wait_for(lock, interval);
+
+		const timer_clock::time_point now = timer_clock::now();
+		for (SchedulerThread* thread : m->workers)
+		{
+			const uint32_t switches = thread->switches.load(std::memory_order_relaxed);
+			if (switches != thread->preemptSeen)
+			{
+				thread->preemptSeen = switches;
+				thread->preemptSince = now;
+			}
+			else if ((switches & 1) && now - thread->preemptSince >= slice)
+			{
+				// signal again if the task is still running a slice later
+				thread->preemptSince = now;
+				thread->preemptPending.store(true);
+				pthread_kill(thread->nativeThread, c_preemptSignal);
+			}
+		}
+	}
+}
+
+static void preemptCreate(Scheduler* s)
+{
+	{
+		std::unique_lock<std::mutex> lock(g_preemptHandler.lock);
+		if (0 == g_preemptHandler.users++)
+		{
+			// SA_NODEFER: a preempted task may switch out of the handler,
+			// and the worker must keep receiving the signal meanwhile
+			struct sigaction action = {};
+			action.sa_sigaction = preemptSignal;
+			action.sa_flags = SA_SIGINFO | SA_RESTART | SA_NODEFER;
+			sigemptyset(&action.sa_mask);
+			sigaction(c_preemptSignal, &action, &g_preemptHandler.previous);
+		}
+	}
+
+	s->preempt = new PreemptMonitor;
+	s->preempt->thread = std::thread(preemptMonitorRun, s);
+}
+
+static void preemptDestroy(Scheduler* s)
+{
+	{
+		std::unique_lock<std::mutex> lock(s->preempt->lock);
+		s->preempt->stop = true;
+	}
+
+	s->preempt->cond.notify_one();
+	s->preempt->thread.join();
+	delete(s->preempt);
+
+	// put the application's handler back once no scheduler needs ours
+	std::unique_lock<std::mutex> lock(g_preemptHandler.lock);
+	if (0 == --g_preemptHandler.users)
+	{
+		sigaction(c_preemptSignal, &g_preemptHandler.previous, nullptr);
+	}
+}
+
+// watch a worker whose scheduler fiber is the thread itself
+static void preemptAttach(Scheduler* s, SchedulerThread* thread)
+{
+	pthread_attr_t attr;
+	if (0 != pthread_getattr_np(pthread_self(), &attr))
+	{
+		return;
+	}
+
+	void* stack;
+	size_t stackSize;
+	pthread_attr_getstack(&attr, &stack, &stackSize);
+	pthread_attr_destroy(&attr);
+
+	thread->stackLow = reinterpret_cast<uintptr_t>(stack);
+	thread->stackHigh = thread->stackLow + stackSize;
+	thread->nativeThread = pthread_self();
+	thread->preemptSeen = thread->switches.load();
+	thread->preemptSince = timer_clock::now();
+	thread->preemptPending.store(false);
+
+	std::unique_lock<std::mutex> lock(s->preempt->lock);
+	s->preempt->workers.push_back(thread);
+	thread->preemptAttached = true;
+}
+
+static void preemptDetach(Scheduler* s, SchedulerThread* thread)
+{
+	thread->preemptAttached = false;
+
+	std::unique_lock<std::mutex> lock(s->preempt->lock);
+	std::vector<SchedulerThread*>& workers = s->preempt->workers;
+	workers.erase(std::find(workers.begin(), workers.end(), thread));
+}
+
+#else
+
+static void preemptCreate(Scheduler*)
+{
+}
+
+static void preemptDestroy(Scheduler*)
+{
+}
+
+static void preemptAttach(Scheduler*, SchedulerThread*)
+{
+}
+
+static void preemptDetach(Scheduler*, SchedulerThread*)
+{
+}
+
+#endif // defined(__linux__)
+
+// main scheduler routine
+static void schedRunFiber(Scheduler* s, Fiber* fiber, bool fiberIsThread, const RunContext* runContext, bool elastic)
+{
+	SchedulerThread thread;
+	thread.fiber = fiber;
+	thread.scheduler = s;
+	thread.current = nullptr;
+	thread.index = s->nextWorkerIndex.fetch_add(1);
+	thread.elastic = elastic;
+	thread.retired = false;
+	thread.dispatches = 0;
+	thread.ring = nullptr;
+	thread.ringFailed = false;
+	thread.chargeGroup = nullptr;
+	thread.dispatchPushes = 0;
+	thread.node = -1;
+	thread.budget.store(0);
+	thread.switches.store(0);
+	thread.preemptAttached = false;
+
+	// take the CPU with the fewest workers, so one started after another
+	// retired reuses its CPU
+	std::vector<int> previousCpus;
+	bool pinned = false;
+	size_t slot = 0;
+	if (!s->workerCpus.empty())
+	{
+		{
+			std::unique_lock<std::mutex> lock(s->runlistLock);
+			slot = static_cast<size_t>(std::min_element(s->workerCpuUsers.begin(), s->workerCpuUsers.end()) - s->workerCpuUsers.begin());
+			++s->workerCpuUsers[slot];
+		}
+
+		pinned = topologyPin(s->workerCpus[slot], &previousCpus);
+		if (pinned)
+		{
+			thread.node = s->workerNodes[slot];
+			s->jobQueues[thread.index % c_jobQueues].node.store(thread.node);
+		}
+	}
+
+	g_currentThreadScheduler = &thread;
+
+	{
+		std::unique_lock<std::mutex> lock(s->runlistLock);
+		++s->workers;
+		if (elastic)
+		{
+			s->growing = false;
+		}
+		else
+		{
+			std::unique_lock<std::mutex> contextsLock(s->elasticContext.contextsLock);
+			s->elasticContext.contexts.push_back(runContext);
+		}
+	}
+
+	// a nested run's scheduler fiber is a task fiber, which the preemption
+	// signal couldn't tell apart
+	if (s->preempt && fiberIsThread)
+	{
+		preemptAttach(s, &thread);
+	}
+
+	for ( ; runContext->running() && !thread.retired; )
+	{
+		// don't let ready descriptors starve behind a busy runlist
+		if (0 == ++thread.dispatches % c_netpollInterval)
+		{
+			netpollPoll(s);
+		}
+
+		// stackless jobs run right here, on the scheduler fiber
+		if (s->queuedJobs.load(std::memory_order_relaxed) > 0)
+		{
+			thread.current = nullptr;
+			if (thread.chargeGroup)
+			{
+				std::unique_lock<std::mutex> lock(s->runlistLock);
+				groupChargeWithLock(&thread);
+			}
+
+			if (jobRunOne())
+			{
+				continue;
+			}
+		}
+
+		Task* const task = waitForTask(s, &thread, runContext);
+		if (!task)
+		{
+			continue;
+		}
+
+		Fiber* const taskFiber = task->fiber;
+		task->thread = &thread;
+
+		thread.current = task;
+		thread.deleteLastFiber = false;
+		task->node = thread.node;
+		task->nodeSkips = 0;
+		thread.budget.store(s->options.coopBudget > 0 ? s->options.coopBudget : INT_MAX, std::memory_order_relaxed);
+
+		task->state.store(TaskState::Running, std::memory_order_relaxed);
+		task->worker.store(thread.index, std::memory_order_relaxed);
+
+		task->runLock.lock();
+		thread.switches.store(thread.switches.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		s->factory->switchTo(fiber, taskFiber);
+		thread.switches.store(thread.switches.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+		// capped groups hand the slot on right away. The task can't be
+		// dispatched elsewhere before its runLock is released
+		TaskGroup* const group = thread.chargeGroup;
+		if (group->maxRunnable > 0)
+		{
+			std::unique_lock<std::mutex> lock(s->runlistLock);
+			groupReleaseWithLock(s, &thread, group, thread.deleteLastFiber ? nullptr : task);
+		}
+
+		// was a delete requested
+		// if so: task has gone out of scope and is no longer valid
+		if (thread.deleteLastFiber)
+		{
+			if (thread.lastStackPainted)
+			{
+				stackProfileRecord(&s->stacks, s->factory, taskFiber, thread.lastName);
+			}
+
+			s->factory->release(taskFiber);
+			thread.chargeExited = true;
+		}
+		else
+		{
+			void (*unlock)(void*) = task->unlock;
+			void* unlockContext = task->unlockContext;
+			task->unlock = nullptr;
+
+			// let other threads scheduler this task
+			task->runLock.unlock();
+
+			// if we have a post unlock context, invoke it now
+			if (unlock)
+			{
+				(unlock)(unlockContext);
+			}
+		}
+
+		uringPoll(s, &thread);
+	}
+
+	if (thread.preemptAttached)
+	{
+		preemptDetach(s, &thread);
+	}
+
+	if (pinned)
+	{
+		topologyRestore(previousCpus);
+	}
+
+	g_currentThreadScheduler = nullptr;
+
+	{
+		std::unique_lock<std::mutex> lock(s->runlistLock);
+		groupChargeWithLock(&thread);
+		--s->workers;
+		if (!elastic)
+		{
+			std::unique_lock<std::mutex> contextsLock(s->elasticContext.contextsLock);
+			std::vector<const RunContext*>& contexts = s->elasticContext.contexts;
+			contexts.erase(std::find(contexts.begin(), contexts.end(), runContext));
+		}
+
+		if (!s->workerCpus.empty())
+		{
+			--s->workerCpuUsers[slot];
+		}
+	}
+
+	// wake up anyone waiting. Even a retiring worker may have run the task
+	// that stopped another worker's context
+	s->runlistCond.notify_all();
+	netpollBreak(s->netpoller);
+}
+
+Scheduler* sched::createScheduler(FiberFactory* factory)
+{
+	return createScheduler(factory, SchedulerOptions());
+}
+
+Scheduler* sched::createScheduler(FiberFactory* factory, const SchedulerOptions& options)
+{
+	// ensure timer context is running
+	// the timer thread is never joined, so its context is never destroyed.
+	// Destroying it at exit would block on the thread's condition variable
+	std::call_once(g_timersRunning, []() {
+		g_timers = new TimerContext;
+		std::thread(timerContextProcess, g_timers).detach();
+	});
+
+	Scheduler* scheduler = new Scheduler;
+	scheduler->factory = factory;
+	scheduler->options = options;
+	scheduler->netpoller = netpollCreate();
+
+	scheduler->defaultGroup.scheduler = scheduler;
+	scheduler->defaultGroup.stride = c_strideScale;
+	scheduler->defaultGroup.maxRunnable = 0;
+
+	if (options.deterministic)
+	{
+		// xorshift state must be non-zero
+		scheduler->random = options.seed ^ 0x9e3779b97f4a7c15ull;
+		if (0 == scheduler->random)
+		{
+			scheduler->random = 1;
+		}
+
+		scheduler->virtualTimers = new TimerContext;
+		scheduler->virtualTimers->virtualClock = true;
+	}
+	else if (options.preemptSliceMS > 0)
+	{
+		preemptCreate(scheduler);
+	}
+
+	if (options.pinWorkers)
+	{
+		std::vector<std::vector<int>> nodes;
+		topologyNodes(&nodes);
+
+		for (size_t node = 0; node != nodes.size(); ++node)
+		{
+			for (int cpu : nodes[node])
+			{
+				scheduler->workerCpus.push_back(cpu);
+				scheduler->workerNodes.push_back(static_cast<int>(node));
+			}
+		}
+
+		scheduler->workerCpuUsers.resize(scheduler->workerCpus.size());
+
+		scheduler->nodeCount = std::max(1, static_cast<int>(nodes.size()));
+	}
+
+	return scheduler;
+}
+
+void sched::destroyScheduler(Scheduler* scheduler)
+{
+	// elastic workers exit once no thread is left in run
+	{
+		std::unique_lock<std::mutex> lock(scheduler->runlistLock);
+		while (scheduler->elasticThreads > 0)
+		{
+			scheduler->runlistCond.notify_all();
+			netpollBreak(scheduler->netpoller);
+			scheduler->elasticCond.wait(lock);
+		}
+	}
+
+	if (scheduler->preempt)
+	{
+		preemptDestroy(scheduler);
+	}
+
+	for (IoRing* ring : scheduler->rings)
+	{
+		uringDestroy(ring);
+	}
+
+	netpollDestroy(scheduler->netpoller);
+	delete(scheduler->virtualTimers);
+	delete(scheduler);
+}
+
+FiberFactory* sched::getFiberFactory(Scheduler* scheduler)
+{
+	return scheduler->factory;
+}
+
+SchedulerStats sched::getSchedulerStats(Scheduler* scheduler)
+{
+	SchedulerStats stats;
+
+	std::unique_lock<std::mutex> lock(scheduler->runlistLock);
+	for (int ii = 0; ii != c_priorityLevels; ++ii)
+	{
+		stats.priorities[ii] = scheduler->priorityStats[ii];
+	}
+
+	stats.deadlinesMet = scheduler->deadlinesMet.load();
+	stats.deadlinesMissed = scheduler->deadlinesMissed.load();
+	stats.lateDispatches = scheduler->lateDispatches;
+	stats.coopYields = scheduler->coopYields.load();
+	stats.preemptions = scheduler->preemptions.load();
+	stats.workers = scheduler->workers;
+	stats.workersStarted = scheduler->workersStarted;
+	stats.workersRetired = scheduler->workersRetired;
+
+	return stats;
+}
+
+TaskGroup* sched::createTaskGroup(Scheduler* scheduler, const TaskGroupOptions& options)
+{
+	const int weight = std::min(std::max(options.weight, 1), c_maxGroupWeight);
+
+	TaskGroup* group = new TaskGroup;
+	group->scheduler = scheduler;
+	group->stride = c_strideScale / static_cast<uint64_t>(weight);
+	group->maxRunnable = std::max(options.maxRunnable, 0);
+
+	std::unique_lock<std::mutex> lock(scheduler->runlistLock);
+	++scheduler->createdGroups;
+	return group;
+}
+
+void sched::destroyTaskGroup(TaskGroup* group)
+{
+	Scheduler* s = group->scheduler;
+
+	Task* current = currentTask();
+	assert(!(current && current->group == group) && "TaskGroup destroyed by one of its own tasks");
+	(void)current;
+
+	// tasks that signalled completion may still be switching out
+	std::unique_lock<std::mutex> lock(s->runlistLock);
+	while (group->tasks > 0 || group->running > 0)
+	{
+		lock.unlock();
+		yield();
+		lock.lock();
+	}
+
+	--s->createdGroups;
+	lock.unlock();
+
+	delete(group);
+}
+
+void sched::run(Scheduler* scheduler, const RunContext* runContext)
+{
+	SchedulerThread* previousThread = g_currentThreadScheduler;
+	Fiber* fiber = previousThread ? previousThread->fiber : scheduler->factory->fromCurrentThread();
+
+	schedRunFiber(scheduler, fiber, !previousThread, runContext, false);
+	g_currentThreadScheduler = previousThread;
+
+	if (!previousThread)
+	{
+		scheduler->factory->releaseCurrentThread(fiber);
+	}
+}
+
+void sched::runFunction(FiberFactory* factory, int nthreads, std::function<void(sched::Scheduler* scheduler)> entry)
+{
+	runFunction(factory, nthreads, SchedulerOptions(), std::move(entry));
+}
+
+void sched::runFunction(FiberFactory* factory, int nthreads, const SchedulerOptions& options, std::function<void(sched::Scheduler* scheduler)> entry)
+{
+	struct Context : RunContext
+	{
+		virtual bool running() const override
+		{
+			return run;
+		}
+
+		bool run = true;
+	};
+
+	Context ctx;
+
+	Scheduler* scheduler = createScheduler(factory, options);
+
+	// deterministic schedulers only run on this thread
+	std::vector<std::thread> threads(options.deterministic ? 0 : std::max(1, nthreads-1));
+
+	sched::spawn(scheduler, [&entry, scheduler, &ctx, &threads]() {
+
+		// start worker threads
+		for (auto& thr : threads)
+		{
+			thr = std::thread(sched::run, scheduler, &ctx);
+		}
+
+		entry(scheduler);
+		ctx.run = false;
+	});
+
+	run(scheduler, &ctx);
+
+	// wait for worker threads to terminate
+	for (auto& thr : threads)
+	{
+		thr.join();
+	}
+
+	destroyScheduler(scheduler);
+}
+
+static void suspendTask(Task* t)
+{
+	FiberFactory* factory = g_currentThreadScheduler->scheduler->factory;
+	factory->switchTo(t->fiber, g_currentThreadScheduler->fiber);
+}
+
+Task* sched::spawn(Scheduler* scheduler, std::function<void()> entry, int stackSize)
+{
+	TaskOptions options;
+	options.stackSize = stackSize;
+	return spawn(scheduler, std::move(entry), options);
+}
+
+// create a task for spawn, ready to be queued. fiber is the caller's
+static Task* spawnCreate(Scheduler* scheduler, Fiber* fiber, std::function<void()> entry, const TaskOptions& options)
+{
+	int stackSize = options.stackSize;
+	bool paintStack = false;
+	if (scheduler->options.profileStacks || scheduler->options.adaptiveStacks)
+	{
+		if (0 == stackSize)
+		{
+			stackSize = stackProfileSelect(&scheduler->stacks, options.name, scheduler->options.adaptiveStacks, &paintStack);
+		}
+		else
+		{
+			paintStack = true;
+		}
+	}
+
+	Task* task = createTask(scheduler->factory, fiber, std::move(entry), stackSize, paintStack);
+	task->scheduler = scheduler;
+	task->name = options.name;
+	task->priority = options.priority;
+	task->deadline = options.deadline.time_since_epoch().count();
+
+	// tasks stay in the group, and start on the node, of the task that
+	// spawned them
+	SchedulerThread* spawner = g_currentThreadScheduler;
+	const bool inherit = spawner && spawner->scheduler == scheduler && spawner->current;
+	task->node = inherit ? spawner->node : -1;
+	task->group = options.group;
+	if (!task->group)
+	{
+		task->group = inherit ? spawner->current->group : &scheduler->defaultGroup;
+	}
+
+	assert(task->group->scheduler == scheduler && "TaskGroup belongs to another scheduler");
+
+	if (scheduler->options.trackTasks)
+	{
+		registryAdd(scheduler, task);
+	}
+
+	return task;
+}
+
+Task* sched::spawn(Scheduler* scheduler, std::function<void()> entry, const TaskOptions& options)
+{
 	Fiber* fiber = nullptr;
 	bool destroyFiber = false;
 	if (g_currentThreadScheduler)
@@ -321,20 +1846,82 @@ Task* sched::spawn(Scheduler* scheduler, std::function<void()> entry, int stackS
 		destroyFiber = true;
 	}
 
-	Task* task = createTask(scheduler->factory, fiber, std::move(entry), stackSize);
+	Task* task = spawnCreate(scheduler, fiber, std::move(entry), options);
+	runlistPush(scheduler, task, 1, true);
 
+	if (destroyFiber)
 	{
-		std::unique_lock<std::mutex> lock(scheduler->runlistLock);
-		tasklistPush(&scheduler->runlist, task);
+		scheduler->factory->releaseCurrentThread(fiber);
+	}
+
+	return task;
+}
+
+void sched::spawnMany(Scheduler* scheduler, int count, std::function<void(int index)> entry)
+{
+	spawnMany(scheduler, count, std::move(entry), TaskOptions());
+}
+
+void sched::spawnMany(Scheduler* scheduler, int count, std::function<void(int index)> entry, const TaskOptions& options)
+{
+	// shared by the batch, and freed by the last of its tasks to return
+	struct Batch
+	{
+		std::function<void(int index)> entry;
+		std::atomic<int> pending;
+	};
+
+	if (count <= 0)
+	{
+		return;
+	}
+
+	Batch* batch = new Batch;
+	batch->entry = std::move(entry);
+	batch->pending.store(count, std::memory_order_relaxed);
+
+	Fiber* fiber = nullptr;
+	bool destroyFiber = false;
+	if (g_currentThreadScheduler)
+	{
+		fiber = g_currentThreadScheduler->current->fiber;
+	}
+	else
+	{
+		fiber = scheduler->factory->fromCurrentThread();
+		destroyFiber = true;
 	}
-	scheduler->runlistCond.notify_one();
+
+	// chain the tasks in index order, then publish them all at once
+	Task* front = nullptr;
+	Task* last = nullptr;
+	for (int ii = 0; ii != count; ++ii)
+	{
+		Task* task = spawnCreate(scheduler, fiber, [batch, ii]() {
+			(batch->entry)(ii);
+			if (1 == batch->pending.fetch_sub(1))
+			{
+				delete(batch);
+			}
+		}, options);
+
+		if (last)
+		{
+			last->next = task;
+		}
+		else
+		{
+			front = task;
+		}
+		last = task;
+	}
+
+	runlistPush(scheduler, front, count, true);
 
 	if (destroyFiber)
 	{
 		scheduler->factory->releaseCurrentThread(fiber);
 	}
-
-	return task;
 }
 
 Task* sched::spawn(std::function<void()> entry, int stackSize)
@@ -342,35 +1929,141 @@ Task* sched::spawn(std::function<void()> entry, int stackSize)
 	return spawn(g_currentThreadScheduler->scheduler, std::move(entry), stackSize);
 }
 
+Task* sched::spawn(std::function<void()> entry, const TaskOptions& options)
+{
+	return spawn(g_currentThreadScheduler->scheduler, std::move(entry), options);
+}
+
+void sched::spawnMany(int count, std::function<void(int index)> entry)
+{
+	spawnMany(g_currentThreadScheduler->scheduler, count, std::move(entry));
+}
+
+void sched::spawnMany(int count, std::function<void(int index)> entry, const TaskOptions& options)
+{
+	spawnMany(g_currentThreadScheduler->scheduler, count, std::move(entry), options);
+}
+
 Task* sched::currentTask()
 {
-	return g_currentThreadScheduler->current;
+	return g_currentThreadScheduler ? g_currentThreadScheduler->current : nullptr;
 }
 
 
 void sched::yield()
 {
+	if (!g_currentThreadScheduler)
+	{
+		std::this_thread::yield();
+		return;
+	}
+
 	Task* task = g_currentThreadScheduler->current;
 
 	wake(task);
 	suspendTask(task);
 }
 
+sched::PreemptibleScope::PreemptibleScope()
+	: task(currentTask())
+{
+	if (task)
+	{
+		task->preemptDepth.fetch_add(1);
+	}
+}
+
+sched::PreemptibleScope::~PreemptibleScope()
+{
+	if (task)
+	{
+		task->preemptDepth.fetch_sub(1);
+	}
+}
+
+void sched::coopConsume()
+{
+	SchedulerThread* thread = g_currentThreadScheduler;
+	if (!thread || !thread->current)
+	{
+		return;
+	}
+
+	const int budget = thread->budget.load(std::memory_order_relaxed) - 1;
+	thread->budget.store(budget, std::memory_order_relaxed);
+	if (budget > 0)
+	{
+		return;
+	}
+
+	thread->scheduler->coopYields.fetch_add(1, std::memory_order_relaxed);
+	yield();
+}
+
 void sched::suspendSelf()
 {
 	Task* task = g_currentThreadScheduler->current;
+	task->state.store(TaskState::Suspended, std::memory_order_relaxed);
 	suspendTask(task);
 }
 
 void sched::wake(Task* t)
 {
-	Scheduler* scheduler = t->thread->scheduler;
+	Scheduler* scheduler = t->scheduler;
+	t->state.store(TaskState::Runnable, std::memory_order_relaxed);
+	t->waitObject.store(nullptr, std::memory_order_relaxed);
+
+	// foreign threads (timers, I/O helpers, library callbacks) skip the
+	// runlist lock unless a worker needs waking
+	SchedulerThread* thread = g_currentThreadScheduler;
+	if (!thread || thread->scheduler != scheduler)
 	{
-		std::unique_lock<std::mutex> lock(scheduler->runlistLock);
-		tasklistPush(&scheduler->runlist, t);
+		inboxPush(scheduler, t, t);
+		return;
 	}
 
-	scheduler->runlistCond.notify_one();
+	runlistPush(scheduler, t, 1, false);
+}
+
+void sched::wakeMany(Task* const* tasks, int ntasks)
+{
+	SchedulerThread* thread = g_currentThreadScheduler;
+	for (int first = 0; first < ntasks; )
+	{
+		// queue each run of tasks from the same scheduler at once
+		Scheduler* scheduler = tasks[first]->scheduler;
+		int end = first;
+		for ( ; end != ntasks && tasks[end]->scheduler == scheduler; ++end)
+		{
+			tasks[end]->state.store(TaskState::Runnable, std::memory_order_relaxed);
+			tasks[end]->waitObject.store(nullptr, std::memory_order_relaxed);
+		}
+
+		if (!thread || thread->scheduler != scheduler)
+		{
+			Task* chain = nullptr;
+			for (int ii = first; ii != end; ++ii)
+			{
+				tasks[ii]->next = chain;
+				chain = tasks[ii];
+			}
+
+			inboxPush(scheduler, chain, tasks[first]);
+		}
+		else
+		{
+			Task* chain = nullptr;
+			for (int ii = end; ii != first; --ii)
+			{
+				tasks[ii - 1]->next = chain;
+				chain = tasks[ii - 1];
+			}
+
+			runlistPush(scheduler, chain, end - first, false);
+		}
+
+		first = end;
+	}
 }
 
 void sched::suspendWithUnlock(Task* t, void unlock(void* context), void* context)
@@ -380,7 +2073,226 @@ void sched::suspendWithUnlock(Task* t, void unlock(void* context), void* context
 	suspendTask(t);
 }
 
+void sched::taskSetBlocked(Task* t, const void* waitObject)
+{
+	t->waitObject.store(waitObject, std::memory_order_relaxed);
+	t->state.store(TaskState::Blocked, std::memory_order_relaxed);
+}
+
+void sched::taskSetSleeping(Task* t, timer_clock::time_point when)
+{
+	t->wakeTime.store(when.time_since_epoch().count(), std::memory_order_relaxed);
+	t->state.store(TaskState::Sleeping, std::memory_order_relaxed);
+}
+
+void sched::dumpTasks(Scheduler* scheduler, std::function<void(const TaskInfo& info)> callback)
+{
+	std::vector<TaskInfo> infos;
+	for (RegistryShard& shard : scheduler->registry)
+	{
+		// copy out under the lock; tasks cannot exit (and release their
+		// stacks) while it is held
+		{
+			std::unique_lock<std::mutex> lock(shard.lock);
+			for (Task* t = shard.head; t; t = t->registryNext)
+			{
+				TaskInfo info;
+				info.task = t;
+				info.name = t->name;
+				info.state = t->state.load(std::memory_order_relaxed);
+				info.priority = t->priority;
+				info.deadline = timer_clock::time_point(timer_clock::duration(t->deadline));
+				info.worker = t->worker.load(std::memory_order_relaxed);
+				info.waitObject = t->waitObject.load(std::memory_order_relaxed);
+				info.wakeTime = timer_clock::time_point(timer_clock::duration(t->wakeTime.load(std::memory_order_relaxed)));
+				infos.push_back(info);
+			}
+		}
+
+		for (const TaskInfo& info : infos)
+		{
+			callback(info);
+		}
+
+		infos.clear();
+	}
+}
+
+void sched::dumpStackUsage(Scheduler* scheduler, std::function<void(const StackUsageInfo& info)> callback)
+{
+	stackProfileDump(&scheduler->stacks, callback);
+}
+
+NetPoller* sched::netpollCurrent()
+{
+	return g_currentThreadScheduler ? g_currentThreadScheduler->scheduler->netpoller : nullptr;
+}
+
+bool sched::jobPush(Job* job)
+{
+	SchedulerThread* thread = g_currentThreadScheduler;
+	if (!thread)
+	{
+		return false;
+	}
+
+	Scheduler* s = thread->scheduler;
+	JobQueue* q = &s->jobQueues[thread->index % c_jobQueues];
+	{
+		std::unique_lock<std::mutex> lock(q->lock);
+		job->next = nullptr;
+		job->prev = q->back;
+		if (q->back)
+		{
+			q->back->next = job;
+		}
+		else
+		{
+			q->front = job;
+		}
+		q->back = job;
+		q->depth.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// may briefly lag (or trail a thief's decrement), but is always raised
+	// before the doorbell checks for parked workers
+	s->queuedJobs.fetch_add(1);
+	doorbell(s);
+	return true;
+}
+
+// take the newest (back) or oldest job from a queue
+static Job* jobQueuePop(JobQueue* q, bool back)
+{
+	if (q->depth.load(std::memory_order_relaxed) <= 0)
+	{
+		return nullptr;
+	}
+
+	std::unique_lock<std::mutex> lock(q->lock);
+	Job* job = back ? q->back : q->front;
+	if (job)
+	{
+		if (job->prev)
+		{
+			job->prev->next = job->next;
+		}
+		else
+		{
+			q->front = job->next;
+		}
+
+		if (job->next)
+		{
+			job->next->prev = job->prev;
+		}
+		else
+		{
+			q->back = job->prev;
+		}
+
+		q->depth.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	return job;
+}
+
+int sched::jobLocalDepth()
+{
+	SchedulerThread* thread = g_currentThreadScheduler;
+	if (!thread)
+	{
+		return 0;
+	}
+
+	return thread->scheduler->jobQueues[thread->index % c_jobQueues].depth.load(std::memory_order_relaxed);
+}
+
+bool sched::jobRunOne()
+{
+	SchedulerThread* thread = g_currentThreadScheduler;
+	if (!thread)
+	{
+		return false;
+	}
+
+	Scheduler* s = thread->scheduler;
+	if (s->queuedJobs.load(std::memory_order_relaxed) <= 0)
+	{
+		return false;
+	}
+
+	const int nqueues = std::min(s->nextWorkerIndex.load(std::memory_order_relaxed), c_jobQueues);
+	const int own = thread->index % c_jobQueues;
+
+	Job* job = jobQueuePop(&s->jobQueues[own], true);
+
+	// steal within the node first
+	if (!job && thread->node >= 0 && s->nodeCount > 1)
+	{
+		for (int ii = 1; !job && ii < nqueues; ++ii)
+		{
+			JobQueue* q = &s->jobQueues[(own + ii) % nqueues];
+			if (q->node.load(std::memory_order_relaxed) == thread->node)
+			{
+				job = jobQueuePop(q, false);
+			}
+		}
+	}
+
+	for (int ii = 1; !job && ii < nqueues; ++ii)
+	{
+		job = jobQueuePop(&s->jobQueues[(own + ii) % nqueues], false);
+	}
+
+	if (!job)
+	{
+		return false;
+	}
+
+	s->queuedJobs.fetch_sub(1);
+	(job->run)(job);
+	return true;
+}
+
+int sched::jobWorkerCount()
+{
+	SchedulerThread* thread = g_currentThreadScheduler;
+	return thread ? thread->scheduler->workers.load(std::memory_order_relaxed) : 0;
+}
+
+IoRing* sched::uringCurrent()
+{
+	SchedulerThread* thread = g_currentThreadScheduler;
+	if (!thread)
+	{
+		return nullptr;
+	}
+
+	if (!thread->ring && !thread->ringFailed)
+	{
+		Scheduler* s = thread->scheduler;
+		thread->ring = uringCreate(s->netpoller);
+		if (thread->ring)
+		{
+			std::unique_lock<std::mutex> lock(s->ringsLock);
+			s->rings.push_back(thread->ring);
+		}
+		else
+		{
+			thread->ringFailed = true;
+		}
+	}
+
+	return thread->ring;
+}
+
 TimerContext* sched::timerContextCurrent()
 {
-	return &g_timers;
+	if (g_currentThreadScheduler && g_currentThreadScheduler->scheduler->virtualTimers)
+	{
+		return g_currentThreadScheduler->scheduler->virtualTimers;
+	}
+
+	return g_timers;
 }
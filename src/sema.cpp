@@ -28,6 +28,13 @@
 #include <cstdint>
 #include <mutex>
 #include "private.h"
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#endif
 #include "sched/scheduler.h"
 #include "sched/sema.h"
 
@@ -35,11 +42,24 @@ using namespace sched;
 
 namespace {
 
+	// blocks a thread that isn't running a task
+	struct Parker
+	{
+#if defined(__linux__)
+		std::atomic<uint32_t> signaled = ATOMIC_VAR_INIT(0);
+#else
+		std::mutex lock;
+		std::condition_variable cond;
+		bool signaled = false;
+#endif
+	};
+
 	struct Waiter
 	{
 		Waiter* next;
-		Task* owner;
+		Task* owner; // nullptr for a parked thread
 		Sema* sema;
+		Parker parker;
 	};
 
 	struct Root
@@ -54,12 +74,53 @@ namespace {
 static constexpr uintptr_t c_rootTableSize = 251;
 static Root g_roots[c_rootTableSize];
 
+// waiting tasks released at once are woken in batches of this size
+static constexpr int c_wakeBatch = 64;
+
 static Root* rootFromAddr(const void* addr)
 {
 	const uintptr_t index = (reinterpret_cast<uintptr_t>(addr) / 8) % c_rootTableSize;
 	return &g_roots[index];
 }
 
+#if defined(__linux__)
+static void parkerWait(Parker* p)
+{
+	uint32_t* addr = reinterpret_cast<uint32_t*>(&p->signaled);
+	while (0 == p->signaled.load())
+	{
+		syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, 0, nullptr, nullptr, 0);
+	}
+}
+
+static void parkerWake(Parker* p)
+{
+	// the waiter may return as soon as signaled is set. A wake on its
+	// abandoned address is harmless
+	uint32_t* addr = reinterpret_cast<uint32_t*>(&p->signaled);
+	p->signaled.store(1);
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+#else
+static void parkerWait(Parker* p)
+{
+	std::unique_lock<std::mutex> lock(p->lock);
+	while (!p->signaled)
+	{
+		p->cond.wait(lock);
+	}
+}
+
+static void parkerWake(Parker* p)
+{
+	// notify with the lock held so the waiter can't destroy the parker out
+	// from under us
+	std::unique_lock<std::mutex> lock(p->lock);
+	p->signaled = true;
+	p->cond.notify_one();
+}
+#endif
+
 static bool tryAcquire(std::atomic<uint32_t>* sem)
 {
 	uint32_t value = sem->load();
@@ -79,6 +140,8 @@ static bool tryAcquire(std::atomic<uint32_t>* sem)
 
 void sched::Sema::acquire()
 {
+	coopConsume();
+
 	// handle the easy, non-contended case
 	if (tryAcquire(&s))
 	{
@@ -109,10 +172,20 @@ void sched::Sema::acquire()
 		w.sema = this;
 		root->head = &w;
 
-		suspendWithUnlock(task, [](void* context) {
-			Root* root = static_cast<Root*>(context);
+		if (task)
+		{
+			taskSetBlocked(task, this);
+			suspendWithUnlock(task, [](void* context) {
+				Root* root = static_cast<Root*>(context);
+				root->lock.unlock();
+			}, root);
+		}
+		else
+		{
+			// not running a task; block the thread instead
 			root->lock.unlock();
-		}, root);
+			parkerWait(&w.parker);
+		}
 
 		if (tryAcquire(&s))
 		{
@@ -124,13 +197,19 @@ void sched::Sema::acquire()
 
 bool sched::Sema::try_acquire()
 {
+	coopConsume();
 	return tryAcquire(&s);
 }
 
-void sched::Sema::release()
+void sched::Sema::release(uint32_t count)
 {
+	if (0 == count)
+	{
+		return;
+	}
+
 	Root* root = rootFromAddr(this);
-	s.fetch_add(1);
+	s.fetch_add(count);
 
 	// easy, no waiters path for this root
 	if (0 == root->waiters.load())
@@ -139,6 +218,7 @@ void sched::Sema::release()
 	}
 
 	Waiter* toAwake = nullptr;
+	Waiter** toAwakeTail = &toAwake;
 	{
 		std::unique_lock<std::mutex> lock(root->lock);
 		if (0 == root->waiters.load())
@@ -147,24 +227,50 @@ void sched::Sema::release()
 			return;
 		}
 
-		// find a task waiting on this semaphore
+		// find up to count tasks waiting on this semaphore
 		Waiter** prev = &root->head;
-		for (Waiter* w = root->head; w; prev = &w->next, w = w->next)
+		for (Waiter* w = root->head; w && 0 != count; w = *prev)
 		{
 			if (w->sema == this)
 			{
 				root->waiters.fetch_sub(1);
-				toAwake = w;
+				--count;
 
 				// unlink w
 				*prev = w->next;
-				break;
+				w->next = nullptr;
+				*toAwakeTail = w;
+				toAwakeTail = &w->next;
+			}
+			else
+			{
+				prev = &w->next;
 			}
 		}
 	}
 
-	if (toAwake)
+	// a waiter is gone once its owner is woken
+	Task* tasks[c_wakeBatch];
+	int ntasks = 0;
+	while (toAwake)
 	{
-		wake(toAwake->owner);
+		Waiter* w = toAwake;
+		toAwake = w->next;
+
+		if (w->owner)
+		{
+			tasks[ntasks++] = w->owner;
+			if (c_wakeBatch == ntasks)
+			{
+				wakeMany(tasks, ntasks);
+				ntasks = 0;
+			}
+		}
+		else
+		{
+			parkerWake(&w->parker);
+		}
 	}
+
+	wakeMany(tasks, ntasks);
 }
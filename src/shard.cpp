@@ -0,0 +1,272 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <thread>
+#include <vector>
+#include "private.h"
+#include "sched/scheduler.h"
+#include "sched/shard.h"
+
+using namespace sched;
+
+namespace {
+
+	struct ShardMessage
+	{
+		std::function<void()> fn;
+		ShardMessage* next;
+	};
+
+	struct Shard;
+
+	// one runSharded call
+	struct ShardSet
+	{
+		std::vector<Shard*> shards;
+	};
+
+	// a single-worker scheduler. Other shards only touch its message queue
+	struct Shard final : RunContext
+	{
+		virtual bool running() const override
+		{
+			return run.load();
+		}
+
+		ShardSet* set;
+		int index;
+		int cpu;
+		Scheduler* scheduler;
+
+		// runs queued messages, and suspends while there are none
+		Task* messageTask;
+
+		// messages not yet taken by messageTask, newest first
+		std::atomic<ShardMessage*> messages = ATOMIC_VAR_INIT(nullptr);
+
+		// messageTask is (about to be) suspended. Cleared by whichever of
+		// the task or a sender gets to it first; a sender that clears it
+		// wakes the task
+		std::atomic<bool> sleeping = ATOMIC_VAR_INIT(false);
+
+		// owned by messageTask
+		bool stop = false;
+
+		std::atomic<bool> run = ATOMIC_VAR_INIT(true);
+	};
+
+} // namespace `anonymous'
+
+static thread_local Shard* g_currentShard;
+
+static Shard* shardGet(int shard)
+{
+	assert(g_currentShard && "not running in runSharded");
+	assert(shard >= 0 && shard < static_cast<int>(g_currentShard->set->shards.size()) && "shard out of range");
+	return g_currentShard->set->shards[shard];
+}
+
+static void shardPost(Shard* shard, std::function<void()> fn)
+{
+	ShardMessage* message = new ShardMessage;
+	message->fn = std::move(fn);
+
+	ShardMessage* head = shard->messages.load(std::memory_order_relaxed);
+	do
+	{
+		message->next = head;
+	} while (!shard->messages.compare_exchange_weak(head, message));
+
+	if (shard->sleeping.load() && shard->sleeping.exchange(false))
+	{
+		wake(shard->messageTask);
+	}
+}
+
+static void shardMessages(Shard* shard)
+{
+	while (!shard->stop)
+	{
+		ShardMessage* head = shard->messages.exchange(nullptr);
+		if (!head)
+		{
+			// check again after announcing the suspend, so a message pushed
+			// in between is either seen here or wakes us
+			shard->sleeping.store(true);
+			if (!shard->messages.load() || !shard->sleeping.exchange(false))
+			{
+				suspendSelf();
+			}
+			continue;
+		}
+
+		// restore the order the messages were sent in
+		ShardMessage* reversed = nullptr;
+		while (head)
+		{
+			ShardMessage* next = head->next;
+			head->next = reversed;
+			reversed = head;
+			head = next;
+		}
+
+		while (reversed)
+		{
+			ShardMessage* next = reversed->next;
+			(reversed->fn)();
+			delete(reversed);
+			reversed = next;
+		}
+	}
+
+	shard->run.store(false);
+}
+
+static void shardRun(Shard* shard)
+{
+	std::vector<int> previousCpus;
+	const bool pinned = shard->cpu >= 0 && topologyPin(shard->cpu, &previousCpus);
+
+	Shard* previousShard = g_currentShard;
+	g_currentShard = shard;
+	run(shard->scheduler, shard);
+	g_currentShard = previousShard;
+
+	if (pinned)
+	{
+		topologyRestore(previousCpus);
+	}
+}
+
+void sched::runSharded(FiberFactory* factory, int nshards, const SchedulerOptions& options, std::function<void()> entry)
+{
+	std::vector<std::vector<int>> nodes;
+	topologyNodes(&nodes);
+
+	std::vector<int> cpus;
+	for (const std::vector<int>& node : nodes)
+	{
+		cpus.insert(cpus.end(), node.begin(), node.end());
+	}
+
+	if (nshards <= 0)
+	{
+		nshards = std::max(1, static_cast<int>(cpus.size()));
+	}
+
+	SchedulerOptions shardOptions = options;
+	shardOptions.deterministic = false;
+	shardOptions.pinWorkers = false;
+	shardOptions.maxWorkers = 0;
+
+	ShardSet set;
+	for (int ii = 0; ii != nshards; ++ii)
+	{
+		Shard* shard = new Shard;
+		shard->set = &set;
+		shard->index = ii;
+		shard->cpu = cpus.empty() ? -1 : cpus[ii % cpus.size()];
+		shard->scheduler = createScheduler(factory, shardOptions);
+		shard->messageTask = spawn(shard->scheduler, [shard]() {
+			shardMessages(shard);
+		});
+
+		set.shards.push_back(shard);
+	}
+
+	spawn(set.shards[0]->scheduler, [&entry, &set]() {
+		entry();
+
+		for (Shard* shard : set.shards)
+		{
+			shardPost(shard, [shard]() {
+				shard->stop = true;
+			});
+		}
+	});
+
+	std::vector<std::thread> threads;
+	for (int ii = 1; ii < nshards; ++ii)
+	{
+		threads.emplace_back(shardRun, set.shards[ii]);
+	}
+
+	shardRun(set.shards[0]);
+
+	for (auto& thr : threads)
+	{
+		thr.join();
+	}
+
+	// messages sent to a shard after it stopped are dropped
+	for (Shard* shard : set.shards)
+	{
+		for (ShardMessage* message = shard->messages.exchange(nullptr); message; )
+		{
+			ShardMessage* next = message->next;
+			delete(message);
+			message = next;
+		}
+
+		destroyScheduler(shard->scheduler);
+		delete(shard);
+	}
+}
+
+int sched::shardCount()
+{
+	return g_currentShard ? static_cast<int>(g_currentShard->set->shards.size()) : 0;
+}
+
+int sched::currentShard()
+{
+	return g_currentShard ? g_currentShard->index : -1;
+}
+
+Scheduler* sched::shardScheduler(int shard)
+{
+	return shardGet(shard)->scheduler;
+}
+
+void sched::spawnOn(int shard, std::function<void()> entry)
+{
+	spawnOn(shard, std::move(entry), TaskOptions());
+}
+
+void sched::spawnOn(int shard, std::function<void()> entry, const TaskOptions& options)
+{
+	shardPost(shardGet(shard), [entry = std::move(entry), options]() mutable {
+		spawn(std::move(entry), options);
+	});
+}
+
+void sched::postTo(int shard, std::function<void()> fn)
+{
+	shardPost(shardGet(shard), std::move(fn));
+}
@@ -0,0 +1,163 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cstdint>
+#include <cstring>
+#include "private.h"
+#include "sched/fiber.h"
+#include "sched/scheduler.h"
+
+using namespace sched;
+
+static constexpr uint8_t c_stackPaint = 0xcd;
+
+// bytes left unpainted below the painting frame's stack pointer
+static constexpr size_t c_stackPaintMargin = 1024;
+
+// samples measured at the default stack size before adaptive sizing starts
+static constexpr uint64_t c_adaptiveWarmup = 16;
+
+// once adaptive sizing has started, one in every c_adaptiveResample tasks
+// runs with the default stack to keep measuring
+static constexpr uint64_t c_adaptiveResample = 32;
+
+static constexpr size_t c_adaptiveMinSize = 16 * 1024;
+
+// round the observed high-water mark (with 2x headroom) up to a power of two
+static int adaptiveSizeClass(const StackProfile::Site* site)
+{
+	size_t size = c_adaptiveMinSize;
+	while (size < site->maxUsed * 2)
+	{
+		size *= 2;
+	}
+
+	// no point in asking for the default (or more)
+	if (size >= site->stackSize)
+	{
+		return 0;
+	}
+
+	return static_cast<int>(size);
+}
+
+int sched::stackProfileSelect(StackProfile* sp, const char* name, bool adaptive, bool* paint)
+{
+	std::unique_lock<std::mutex> lock(sp->lock);
+	StackProfile::Site* site = &sp->sites[name ? name : ""];
+	++site->spawned;
+
+	if (!adaptive || site->samples < c_adaptiveWarmup || 0 == site->spawned % c_adaptiveResample)
+	{
+		*paint = true;
+		return 0;
+	}
+
+	*paint = false;
+	return site->adaptiveSize;
+}
+
+void sched::stackPaint(FiberFactory* factory, Fiber* fiber)
+{
+	void* base;
+	size_t size;
+	if (!factory->stackBounds(fiber, &base, &size))
+	{
+		return;
+	}
+
+	// everything below our own frame is unused
+	uint8_t marker;
+	const uintptr_t low = reinterpret_cast<uintptr_t>(base);
+	const uintptr_t top = reinterpret_cast<uintptr_t>(&marker) - c_stackPaintMargin;
+	if (top > low && top < low + size)
+	{
+		std::memset(base, c_stackPaint, top - low);
+	}
+}
+
+void sched::stackProfileRecord(StackProfile* sp, FiberFactory* factory, Fiber* fiber, const char* name)
+{
+	void* base;
+	size_t size;
+	if (!factory->stackBounds(fiber, &base, &size))
+	{
+		return;
+	}
+
+	// scan up from the bottom of the stack for the first overwritten byte
+	const uint8_t* const bottom = static_cast<const uint8_t*>(base);
+	const uint8_t* p = bottom;
+	const uint8_t* const end = bottom + size;
+	while (p != end && *p == c_stackPaint)
+	{
+		++p;
+	}
+
+	const size_t used = static_cast<size_t>(end - p);
+
+	std::unique_lock<std::mutex> lock(sp->lock);
+	StackProfile::Site* site = &sp->sites[name ? name : ""];
+	++site->samples;
+	site->totalUsed += used;
+	if (used > site->maxUsed)
+	{
+		site->maxUsed = used;
+	}
+	if (size > site->stackSize)
+	{
+		site->stackSize = size;
+	}
+
+	site->adaptiveSize = adaptiveSizeClass(site);
+}
+
+void sched::stackProfileDump(StackProfile* sp, const std::function<void(const StackUsageInfo& info)>& callback)
+{
+	std::vector<std::pair<std::string, StackProfile::Site>> sites;
+	{
+		std::unique_lock<std::mutex> lock(sp->lock);
+		sites.assign(sp->sites.begin(), sp->sites.end());
+	}
+
+	for (const auto& entry : sites)
+	{
+		const StackProfile::Site& site = entry.second;
+		if (0 == site.samples)
+		{
+			continue;
+		}
+
+		StackUsageInfo info;
+		info.name = entry.first.empty() ? nullptr : entry.first.c_str();
+		info.samples = site.samples;
+		info.maxUsed = site.maxUsed;
+		info.averageUsed = static_cast<size_t>(site.totalUsed / site.samples);
+		info.stackSize = site.stackSize;
+		info.adaptiveSize = site.adaptiveSize;
+		callback(info);
+	}
+}
@@ -0,0 +1,154 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cassert>
+#include "sched/taskgraph.h"
+
+using namespace sched;
+
+// a successor can continue on its predecessor's task only if the task would
+// have been spawned the same way
+static bool continuesInline(const TaskOptions& current, const TaskOptions& next)
+{
+	return current.name == next.name
+		&& current.stackSize == next.stackSize
+		&& current.priority == next.priority
+		&& current.group == next.group
+		&& current.deadline == next.deadline;
+}
+
+TaskGraph::Node TaskGraph::add(std::function<void()> fn)
+{
+	return add(std::move(fn), TaskOptions());
+}
+
+TaskGraph::Node TaskGraph::add(std::function<void()> fn, const TaskOptions& options)
+{
+	nodes.emplace_back();
+
+	NodeData& node = nodes.back();
+	node.fn = std::move(fn);
+	node.options = options;
+	return static_cast<Node>(nodes.size() - 1);
+}
+
+void TaskGraph::precede(Node before, Node after)
+{
+	assert(before != after && "TaskGraph node cannot depend on itself");
+
+	nodes[before].successors.push_back(after);
+	++nodes[after].dependencies;
+}
+
+void TaskGraph::run()
+{
+	run(nullptr);
+}
+
+void TaskGraph::run(Scheduler* scheduler)
+{
+	if (nodes.empty())
+	{
+		return;
+	}
+
+	this->scheduler = scheduler;
+	remaining.store(static_cast<int>(nodes.size()));
+	for (NodeData& node : nodes)
+	{
+		node.pending.store(node.dependencies, std::memory_order_relaxed);
+	}
+
+	bool started = false;
+	for (Node ii = 0, n = static_cast<Node>(nodes.size()); ii != n; ++ii)
+	{
+		if (0 == nodes[ii].dependencies)
+		{
+			spawnNode(ii);
+			started = true;
+		}
+	}
+
+	assert(started && "TaskGraph has a cycle");
+	(void)started;
+
+	done.acquire();
+}
+
+void TaskGraph::spawnNode(Node node)
+{
+	const TaskOptions& options = nodes[node].options;
+	if (scheduler)
+	{
+		spawn(scheduler, [this, node]() { execute(node); }, options);
+	}
+	else
+	{
+		spawn([this, node]() { execute(node); }, options);
+	}
+}
+
+void TaskGraph::execute(Node node)
+{
+	for (;;)
+	{
+		NodeData& current = nodes[node];
+		current.fn();
+
+		// release successors. Keep the first that is ready for ourselves,
+		// if it runs with the same options
+		Node next = -1;
+		for (Node successor : current.successors)
+		{
+			if (1 != nodes[successor].pending.fetch_sub(1))
+			{
+				continue;
+			}
+
+			if (next < 0 && continuesInline(current.options, nodes[successor].options))
+			{
+				next = successor;
+			}
+			else
+			{
+				spawnNode(successor);
+			}
+		}
+
+		// the graph may be gone once the last node is reported
+		if (1 == remaining.fetch_sub(1))
+		{
+			done.release();
+		}
+
+		if (next < 0)
+		{
+			return;
+		}
+
+		node = next;
+	}
+}
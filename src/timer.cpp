@@ -25,6 +25,7 @@
 */
 
 #include <chrono>
+#include <thread>
 #include "private.h"
 #include "sched/scheduler.h"
 #include "sched/timer.h"
@@ -33,6 +34,8 @@ using namespace sched;
 
 typedef std::chrono::high_resolution_clock timer_clock;
 
+static constexpr int c_expireBatch = 64;
+
 struct sched::TimerContext::Timer
 {
 	timer_clock::time_point when;
@@ -148,58 +151,74 @@ static void addWithLock(TimerContext* ctx, TimerContext::Timer* timer)
 	}
 }
 
-void sched::timerContextProcess(TimerContext* ctx)
+// wake all timers that expire at or before now. Returns the time until the
+// next timer expires
+static timer_clock::duration expireWithLock(TimerContext* ctx, timer_clock::time_point now)
 {
+	timer_clock::duration delta;
+
+	// expired tasks are woken in batches
+	Task* expired[c_expireBatch];
+	int nexpired = 0;
+
+	// loop as long as we have a timer that is expired
 	for (;;)
 	{
-		std::unique_lock<std::mutex> lock(ctx->lock);
-		auto now = timer_clock::now();
-		timer_clock::duration delta;
-
-		// loop as long as we have a timer that is expired
-		for (;;)
+		TimerContext::Timer** timers = ctx->timers.data();
+		const int ntimers = static_cast<int>(ctx->timers.size());
+		if (ntimers == 0)
 		{
-			TimerContext::Timer** timers = ctx->timers.data();
-			const int ntimers = static_cast<int>(ctx->timers.size());
-			if (ntimers == 0)
-			{
-				// no timers
-				delta = delta.max();
-				break;
-			}
+			// no timers
+			wakeMany(expired, nexpired);
+			return delta.max();
+		}
 
-			// is the first timer ready to expire?
-			TimerContext::Timer* t = timers[0];
-			delta = t->when - now;
-			if (delta > delta.zero())
-			{
-				// timer has not expired
-				break;
-			}
+		// is the first timer ready to expire?
+		TimerContext::Timer* t = timers[0];
+		delta = t->when - now;
+		if (delta > delta.zero())
+		{
+			// timer has not expired
+			wakeMany(expired, nexpired);
+			return delta;
+		}
 
-			// remove the timer from the heap
-			const int lastIndex = ntimers - 1;
-			if (lastIndex > 0)
-			{
-				// pull the latest timer to the head (we'll push it down in a moment)
-				timers[0] = timers[lastIndex];
-				timers[0]->internalHeapIndex = 0;
-			}
+		// remove the timer from the heap
+		const int lastIndex = ntimers - 1;
+		if (lastIndex > 0)
+		{
+			// pull the latest timer to the head (we'll push it down in a moment)
+			timers[0] = timers[lastIndex];
+			timers[0]->internalHeapIndex = 0;
+		}
 
-			ctx->timers.pop_back();
+		ctx->timers.pop_back();
 
-			// ensure the root node is correct
-			if (lastIndex > 0)
-			{
-				heapBubbleDown(ctx, 0);
-			}
+		// ensure the root node is correct
+		if (lastIndex > 0)
+		{
+			heapBubbleDown(ctx, 0);
+		}
 
-			// mark the timer as removed
-			t->internalHeapIndex = -1;
+		// mark the timer as removed
+		t->internalHeapIndex = -1;
 
-			// wake the timer's owning task
-			wake(t->task);
+		// wake the timer's owning task. The timer is gone once it runs
+		expired[nexpired++] = t->task;
+		if (c_expireBatch == nexpired)
+		{
+			wakeMany(expired, nexpired);
+			nexpired = 0;
 		}
+	}
+}
+
+void sched::timerContextProcess(TimerContext* ctx)
+{
+	for (;;)
+	{
+		std::unique_lock<std::mutex> lock(ctx->lock);
+		const timer_clock::duration delta = expireWithLock(ctx, timer_clock::now());
 
 		// wait for a wakeup, or for the next timer to exipre
 		if (delta == delta.max())
@@ -213,16 +232,40 @@ void sched::timerContextProcess(TimerContext* ctx)
 	}
 }
 
+bool sched::timerContextAdvance(TimerContext* ctx)
+{
+	std::unique_lock<std::mutex> lock(ctx->lock);
+	if (ctx->timers.empty())
+	{
+		return false;
+	}
+
+	if (ctx->timers[0]->when > ctx->now)
+	{
+		ctx->now = ctx->timers[0]->when;
+	}
+
+	expireWithLock(ctx, ctx->now);
+	return true;
+}
+
 void sched::sleepMS(int ms)
 {
 	Task* task = currentTask();
+	if (!task)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+		return;
+	}
+
+	TimerContext* timers = timerContextCurrent();
+	timers->lock.lock();
 
 	TimerContext::Timer timer;
-	timer.when = timer_clock::now() + std::chrono::milliseconds(ms);
+	timer.when = (timers->virtualClock ? timers->now : timer_clock::now()) + std::chrono::milliseconds(ms);
 	timer.task = task;
 
-	TimerContext* timers = timerContextCurrent();
-	timers->lock.lock();
+	taskSetSleeping(task, timer.when);
 
 	addWithLock(timers, &timer);
 
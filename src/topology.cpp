@@ -0,0 +1,191 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <thread>
+#include <vector>
+#include "private.h"
+
+#if defined(__linux__)
+
+#include <cstdio>
+#include <pthread.h>
+#include <sched.h>
+
+using namespace sched;
+
+// parse a sysfs cpu list such as "0-3,8-11"
+static void parseCpuList(const char* path, std::vector<int>* cpus)
+{
+	FILE* fp = std::fopen(path, "r");
+	if (!fp)
+	{
+		return;
+	}
+
+	int first;
+	while (1 == std::fscanf(fp, "%d", &first))
+	{
+		int last = first;
+		int c = std::fgetc(fp);
+		if ('-' == c)
+		{
+			if (1 != std::fscanf(fp, "%d", &last))
+			{
+				break;
+			}
+			c = std::fgetc(fp);
+		}
+
+		for (int cpu = first; cpu <= last; ++cpu)
+		{
+			cpus->push_back(cpu);
+		}
+
+		if (',' != c)
+		{
+			break;
+		}
+	}
+
+	std::fclose(fp);
+}
+
+void sched::topologyNodes(std::vector<std::vector<int>>* nodes)
+{
+	nodes->clear();
+
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (0 != sched_getaffinity(0, sizeof(allowed), &allowed))
+	{
+		return;
+	}
+
+	std::vector<int> online;
+	parseCpuList("/sys/devices/system/node/online", &online);
+
+	for (int node : online)
+	{
+		char path[64];
+		std::snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+		std::vector<int> cpus;
+		parseCpuList(path, &cpus);
+
+		// only the CPUs this process may run on
+		std::vector<int> usable;
+		for (int cpu : cpus)
+		{
+			if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+			{
+				usable.push_back(cpu);
+			}
+		}
+
+		if (!usable.empty())
+		{
+			nodes->push_back(std::move(usable));
+		}
+	}
+
+	// no NUMA information: a single node
+	if (nodes->empty())
+	{
+		std::vector<int> cpus;
+		for (int cpu = 0; cpu != CPU_SETSIZE; ++cpu)
+		{
+			if (CPU_ISSET(cpu, &allowed))
+			{
+				cpus.push_back(cpu);
+			}
+		}
+
+		nodes->push_back(std::move(cpus));
+	}
+}
+
+bool sched::topologyPin(int cpu, std::vector<int>* previous)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (0 != pthread_getaffinity_np(pthread_self(), sizeof(set), &set))
+	{
+		return false;
+	}
+
+	previous->clear();
+	for (int ii = 0; ii != CPU_SETSIZE; ++ii)
+	{
+		if (CPU_ISSET(ii, &set))
+		{
+			previous->push_back(ii);
+		}
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return 0 == pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+void sched::topologyRestore(const std::vector<int>& previous)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu : previous)
+	{
+		CPU_SET(cpu, &set);
+	}
+
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+#else
+
+using namespace sched;
+
+void sched::topologyNodes(std::vector<std::vector<int>>* nodes)
+{
+	nodes->clear();
+
+	std::vector<int> cpus;
+	for (int cpu = 0, ncpus = static_cast<int>(std::thread::hardware_concurrency()); cpu < ncpus; ++cpu)
+	{
+		cpus.push_back(cpu);
+	}
+
+	nodes->push_back(std::move(cpus));
+}
+
+bool sched::topologyPin(int, std::vector<int>*)
+{
+	return false;
+}
+
+void sched::topologyRestore(const std::vector<int>&)
+{
+}
+
+#endif // defined(__linux__)
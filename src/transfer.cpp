@@ -0,0 +1,311 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if defined(__linux__)
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <mutex>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#include <vector>
+#include "private.h"
+#include "sched/net.h"
+#include "sched/scheduler.h"
+
+using namespace sched;
+
+namespace {
+
+	struct Pipe
+	{
+		int fds[2];
+	};
+
+	// empty pipes for copyFd to reuse. Shared by every thread, as a copy
+	// may finish on another worker than the one it started on. Each copy
+	// keeps its pipe for the whole call
+	struct PipePool
+	{
+		std::mutex lock;
+		std::vector<Pipe> pipes;
+
+		~PipePool()
+		{
+			for (const Pipe& p : pipes)
+			{
+				::close(p.fds[0]);
+				::close(p.fds[1]);
+			}
+		}
+	};
+
+} // namespace `anonymous'
+
+static constexpr size_t c_maxPooledPipes = 8;
+static constexpr int c_pipeSize = 256 * 1024;
+
+// kernel limit on a single transfer (MAX_RW_COUNT), just under 2GB
+static constexpr size_t c_maxTransfer = 0x7ffff000;
+
+static PipePool g_pipes;
+
+static bool pipeAcquire(Pipe* p)
+{
+	{
+		std::unique_lock<std::mutex> lock(g_pipes.lock);
+		if (!g_pipes.pipes.empty())
+		{
+			*p = g_pipes.pipes.back();
+			g_pipes.pipes.pop_back();
+			return true;
+		}
+	}
+
+	if (0 != pipe2(p->fds, O_NONBLOCK | O_CLOEXEC))
+	{
+		return false;
+	}
+
+	// larger pipes mean fewer trips through the loop. Fails harmlessly
+	// above the system limit
+	fcntl(p->fds[1], F_SETPIPE_SZ, c_pipeSize);
+	return true;
+}
+
+// return a pipe to the pool. Pipes still holding data are discarded
+static void pipeRelease(const Pipe& p, bool empty)
+{
+	if (empty)
+	{
+		std::unique_lock<std::mutex> lock(g_pipes.lock);
+		if (g_pipes.pipes.size() < c_maxPooledPipes)
+		{
+			g_pipes.pipes.push_back(p);
+			return;
+		}
+	}
+
+	::close(p.fds[0]);
+	::close(p.fds[1]);
+}
+
+static bool wouldBlock()
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+// a transfer between two descriptors would block. Wait for whichever side
+// is not ready. Returns -1 if it can't be polled
+static int waitTransfer(int inFd, int outFd)
+{
+	pollfd pfd[2];
+	pfd[0].fd = inFd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = outFd;
+	pfd[1].events = POLLOUT;
+	::poll(pfd, 2, 0);
+
+	if (0 == pfd[0].revents)
+	{
+		return waitReadable(inFd);
+	}
+	else if (0 == pfd[1].revents)
+	{
+		return waitWritable(outFd);
+	}
+	else if (currentTask())
+	{
+		// both ready again already; retry after letting others run
+		yield();
+	}
+
+	return 0;
+}
+
+ssize_t sched::sendfile(int outFd, int inFd, int64_t* offset, size_t count)
+{
+	coopConsume();
+
+	off_t off = offset ? static_cast<off_t>(*offset) : 0;
+	for (;;)
+	{
+		const ssize_t n = ::sendfile(outFd, inFd, offset ? &off : nullptr, count);
+		if (offset)
+		{
+			*offset = off;
+		}
+
+		if (n >= 0 || (errno != EINTR && !wouldBlock()))
+		{
+			return n;
+		}
+
+		if (wouldBlock() && 0 != waitWritable(outFd))
+		{
+			return -1;
+		}
+	}
+}
+
+ssize_t sched::splice(int inFd, int64_t* inOffset, int outFd, int64_t* outOffset, size_t len)
+{
+	coopConsume();
+
+	loff_t inOff = inOffset ? *inOffset : 0;
+	loff_t outOff = outOffset ? *outOffset : 0;
+	for (;;)
+	{
+		const ssize_t n = ::splice(inFd, inOffset ? &inOff : nullptr, outFd, outOffset ? &outOff : nullptr, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (inOffset)
+		{
+			*inOffset = inOff;
+		}
+		if (outOffset)
+		{
+			*outOffset = outOff;
+		}
+
+		if (n >= 0 || (errno != EINTR && !wouldBlock()))
+		{
+			return n;
+		}
+
+		if (wouldBlock() && 0 != waitTransfer(inFd, outFd))
+		{
+			return -1;
+		}
+	}
+}
+
+ssize_t sched::tee(int inFd, int outFd, size_t len)
+{
+	coopConsume();
+
+	for (;;)
+	{
+		const ssize_t n = ::tee(inFd, outFd, len, SPLICE_F_NONBLOCK);
+		if (n >= 0 || (errno != EINTR && !wouldBlock()))
+		{
+			return n;
+		}
+
+		if (wouldBlock() && 0 != waitTransfer(inFd, outFd))
+		{
+			return -1;
+		}
+	}
+}
+
+// copy through a pooled pipe. The pipe is always drained before it is
+// refilled, so only inFd and outFd can make a splice block
+static ssize_t copySplice(int outFd, int inFd, int64_t* offset, size_t count)
+{
+	Pipe p;
+	if (!pipeAcquire(&p))
+	{
+		return -1;
+	}
+
+	ssize_t total = 0;
+	size_t buffered = 0;
+	int error = 0;
+	while (static_cast<size_t>(total) < count)
+	{
+		// the kernel rejects lengths beyond its I/O limit; a pipe's worth is
+		// all that can move at once anyway
+		const size_t len = std::min(count - static_cast<size_t>(total), static_cast<size_t>(c_pipeSize));
+		const ssize_t in = sched::splice(inFd, offset, p.fds[1], nullptr, len);
+		if (in <= 0)
+		{
+			error = (in < 0) ? errno : 0;
+			break;
+		}
+
+		buffered = static_cast<size_t>(in);
+		while (buffered)
+		{
+			const ssize_t out = sched::splice(p.fds[0], nullptr, outFd, nullptr, buffered);
+			if (out < 0)
+			{
+				error = errno;
+				break;
+			}
+
+			buffered -= static_cast<size_t>(out);
+			total += out;
+		}
+
+		if (buffered)
+		{
+			break;
+		}
+	}
+
+	pipeRelease(p, 0 == buffered);
+
+	if (error && 0 == total)
+	{
+		errno = error;
+		return -1;
+	}
+
+	return total;
+}
+
+ssize_t sched::copyFd(int outFd, int inFd, int64_t* offset, size_t count)
+{
+	ssize_t total = 0;
+	while (static_cast<size_t>(total) < count)
+	{
+		const size_t len = std::min(count - static_cast<size_t>(total), c_maxTransfer);
+		const ssize_t n = sched::sendfile(outFd, inFd, offset, len);
+		if (n > 0)
+		{
+			total += n;
+			continue;
+		}
+
+		if (0 == n)
+		{
+			return total;
+		}
+
+		// inFd can't be mapped (a socket or pipe). Splice the rest instead
+		if ((errno == EINVAL || errno == ENOSYS) && 0 == total)
+		{
+			return copySplice(outFd, inFd, offset, count);
+		}
+
+		return total ? total : -1;
+	}
+
+	return total;
+}
+
+#endif // defined(__linux__)
@@ -0,0 +1,502 @@
+/**
+* Copyright 2015-2017 Matthew Endsley
+* All rights reserved
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted providing that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+* OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+* HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+* STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+* IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "private.h"
+#include "sched/scheduler.h"
+
+#if defined(__linux__) && defined(__has_include)
+#	if __has_include(<linux/io_uring.h>)
+#		define SCHED_IO_URING 1
+#	endif
+#endif
+
+using namespace sched;
+
+#if SCHED_IO_URING
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <mutex>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "sched/uring.h"
+
+namespace {
+
+	// lives on the stack of the task waiting for the operation
+	struct Completion
+	{
+		Task* task;
+		int32_t result;
+	};
+
+} // namespace `anonymous'
+
+static constexpr unsigned c_ringEntries = 256;
+
+// submit once this many operations are queued...
+static constexpr unsigned c_submitBatch = 32;
+
+// ...or once queued operations have waited this many scheduling rounds
+static constexpr unsigned c_submitRounds = 4;
+
+struct sched::IoRing
+{
+	int fd;
+	int eventfd;
+	NetPoller* netpoller;
+
+	void* sqMap;
+	size_t sqMapSize;
+	void* cqMap;
+	size_t cqMapSize;
+	io_uring_sqe* sqes;
+	size_t sqesSize;
+
+	// submission queue. Only written by the owning worker
+	unsigned* sqHead;
+	unsigned* sqTail;
+	unsigned sqMask;
+	unsigned sqEntries;
+	unsigned* sqArray;
+	unsigned sqLocalTail;
+	unsigned pending;
+	unsigned pendingRounds;
+
+	// completion queue. Reaped by the owning worker, or by the poller once
+	// the worker has gone idle
+	std::mutex cqLock;
+	unsigned* cqHead;
+	unsigned* cqTail;
+	unsigned cqMask;
+	unsigned cqEntries;
+	io_uring_cqe* cqes;
+
+	// operations submitted but not reaped
+	std::atomic<unsigned> inflight = ATOMIC_VAR_INIT(0);
+};
+
+static int uringSetup(unsigned entries, io_uring_params* params)
+{
+	return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int uringEnter(int fd, unsigned toSubmit)
+{
+	return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, 0, 0, nullptr, 0));
+}
+
+bool sched::uringAvailable()
+{
+	static const bool available = []() {
+		io_uring_params params;
+		std::memset(&params, 0, sizeof(params));
+
+		const int fd = uringSetup(1, &params);
+		if (fd < 0)
+		{
+			return false;
+		}
+
+		::close(fd);
+		return true;
+	}();
+
+	return available;
+}
+
+static int uringCollect(void* context, Task** tasks, int maxTasks)
+{
+	IoRing* ring = static_cast<IoRing*>(context);
+
+	uint64_t value;
+	while (::read(ring->eventfd, &value, sizeof(value)) > 0)
+	{
+	}
+
+	const int ntasks = uringReap(ring, tasks, maxTasks);
+
+	// out of room; make sure the poller comes back for the rest
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (*ring->cqHead != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+	{
+		const uint64_t one = 1;
+		const ssize_t result = ::write(ring->eventfd, &one, sizeof(one));
+		(void)result;
+	}
+
+	return ntasks;
+}
+
+IoRing* sched::uringCreate(NetPoller* np)
+{
+	// an idle worker relies on the poller to learn about completions
+	if (!np || !uringAvailable())
+	{
+		return nullptr;
+	}
+
+	io_uring_params params;
+	std::memset(&params, 0, sizeof(params));
+
+	const int fd = uringSetup(c_ringEntries, &params);
+	if (fd < 0)
+	{
+		return nullptr;
+	}
+
+	IoRing* ring = new IoRing;
+	ring->fd = fd;
+	ring->netpoller = np;
+
+	ring->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	const bool singleMap = 0 != (params.features & IORING_FEAT_SINGLE_MMAP);
+	if (singleMap && ring->cqMapSize > ring->sqMapSize)
+	{
+		ring->sqMapSize = ring->cqMapSize;
+	}
+
+	ring->sqMap = mmap(nullptr, ring->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	ring->cqMap = singleMap ? ring->sqMap : mmap(nullptr, ring->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	ring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	ring->sqes = static_cast<io_uring_sqe*>(mmap(nullptr, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+
+	ring->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ring->sqMap == MAP_FAILED || ring->cqMap == MAP_FAILED || ring->sqes == MAP_FAILED || ring->eventfd < 0)
+	{
+		uringDestroy(ring);
+		return nullptr;
+	}
+
+	char* sq = static_cast<char*>(ring->sqMap);
+	ring->sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+	ring->sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	ring->sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	ring->sqEntries = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+	ring->sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+	ring->sqLocalTail = *ring->sqTail;
+	ring->pending = 0;
+	ring->pendingRounds = 0;
+
+	char* cq = static_cast<char*>(ring->cqMap);
+	ring->cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	ring->cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	ring->cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	ring->cqEntries = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_entries);
+	ring->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+	// completions signal the eventfd, which the scheduler's poller watches
+	if (0 != syscall(__NR_io_uring_register, fd, IORING_REGISTER_EVENTFD, &ring->eventfd, 1) ||
+		!netpollAddSource(np, ring->eventfd, uringCollect, ring))
+	{
+		uringDestroy(ring);
+		return nullptr;
+	}
+
+	return ring;
+}
+
+void sched::uringDestroy(IoRing* ring)
+{
+	if (!ring)
+	{
+		return;
+	}
+
+	if (ring->sqes && ring->sqes != MAP_FAILED)
+	{
+		munmap(ring->sqes, ring->sqesSize);
+	}
+	if (ring->cqMap && ring->cqMap != MAP_FAILED && ring->cqMap != ring->sqMap)
+	{
+		munmap(ring->cqMap, ring->cqMapSize);
+	}
+	if (ring->sqMap && ring->sqMap != MAP_FAILED)
+	{
+		munmap(ring->sqMap, ring->sqMapSize);
+	}
+	if (ring->eventfd >= 0)
+	{
+		::close(ring->eventfd);
+	}
+
+	::close(ring->fd);
+	delete(ring);
+}
+
+bool sched::uringFlush(IoRing* ring, bool force)
+{
+	if (0 == ring->pending)
+	{
+		return false;
+	}
+
+	if (!force && ring->pending < c_submitBatch && ++ring->pendingRounds < c_submitRounds)
+	{
+		return false;
+	}
+
+	const int submitted = uringEnter(ring->fd, ring->pending);
+	if (submitted > 0)
+	{
+		ring->pending -= static_cast<unsigned>(submitted);
+	}
+
+	ring->pendingRounds = 0;
+	return submitted > 0;
+}
+
+int sched::uringReap(IoRing* ring, Task** tasks, int maxTasks)
+{
+	std::unique_lock<std::mutex> lock(ring->cqLock, std::try_to_lock);
+	if (!lock.owns_lock())
+	{
+		return 0;
+	}
+
+	unsigned head = *ring->cqHead;
+	const unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+
+	int ntasks = 0;
+	for (; head != tail && ntasks < maxTasks; ++head)
+	{
+		const io_uring_cqe* cqe = &ring->cqes[head & ring->cqMask];
+		Completion* c = reinterpret_cast<Completion*>(static_cast<uintptr_t>(cqe->user_data));
+		c->result = cqe->res;
+		tasks[ntasks++] = c->task;
+	}
+
+	__atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+	ring->inflight.fetch_sub(static_cast<unsigned>(ntasks));
+	return ntasks;
+}
+
+// get the next free submission entry, or nullptr if the ring is full
+static io_uring_sqe* ringGetSqe(IoRing* ring)
+{
+	// keep completions from overflowing the completion queue
+	if (ring->inflight.load() >= ring->cqEntries)
+	{
+		return nullptr;
+	}
+
+	const unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+	if (ring->sqLocalTail - head >= ring->sqEntries)
+	{
+		return nullptr;
+	}
+
+	const unsigned index = ring->sqLocalTail & ring->sqMask;
+	io_uring_sqe* sqe = &ring->sqes[index];
+	std::memset(sqe, 0, sizeof(*sqe));
+	ring->sqArray[index] = index;
+	return sqe;
+}
+
+// queue an operation on the worker's ring and suspend until it completes.
+// Returns the cqe result (-errno on failure)
+template<typename Prepare>
+static int32_t ringSubmit(Prepare prepare)
+{
+	Task* task = currentTask();
+
+	IoRing* ring;
+	io_uring_sqe* sqe;
+	for (;;)
+	{
+		// the task may move to another worker while it waits for room
+		ring = uringCurrent();
+		if (!ring)
+		{
+			return -ENOSYS;
+		}
+
+		sqe = ringGetSqe(ring);
+		if (sqe)
+		{
+			break;
+		}
+
+		uringFlush(ring, true);
+		yield();
+	}
+
+	Completion c;
+	c.task = task;
+	c.result = 0;
+
+	prepare(sqe);
+	sqe->user_data = reinterpret_cast<uintptr_t>(&c);
+
+	++ring->sqLocalTail;
+	__atomic_store_n(ring->sqTail, ring->sqLocalTail, __ATOMIC_RELEASE);
+	++ring->pending;
+	ring->inflight.fetch_add(1);
+	netpollAddWaiters(ring->netpoller, 1);
+
+	// the worker submits the entry after we have switched out, so the
+	// completion cannot race our suspension
+	taskSetBlocked(task, ring);
+	suspendWithUnlock(task, nullptr, nullptr);
+	return c.result;
+}
+
+static ssize_t uringResult(int32_t result)
+{
+	if (result < 0)
+	{
+		errno = -result;
+		return -1;
+	}
+
+	return result;
+}
+
+ssize_t sched::uringRead(int fd, void* buf, size_t count, int64_t offset)
+{
+	if (!netpollCurrent())
+	{
+		return offset < 0 ? ::read(fd, buf, count) : ::pread(fd, buf, count, offset);
+	}
+
+	return uringResult(ringSubmit([=](io_uring_sqe* sqe) {
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = fd;
+		sqe->addr = reinterpret_cast<uintptr_t>(buf);
+		sqe->len = static_cast<uint32_t>(count);
+		sqe->off = static_cast<uint64_t>(offset);
+	}));
+}
+
+ssize_t sched::uringWrite(int fd, const void* buf, size_t count, int64_t offset)
+{
+	if (!netpollCurrent())
+	{
+		return offset < 0 ? ::write(fd, buf, count) : ::pwrite(fd, buf, count, offset);
+	}
+
+	return uringResult(ringSubmit([=](io_uring_sqe* sqe) {
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->fd = fd;
+		sqe->addr = reinterpret_cast<uintptr_t>(buf);
+		sqe->len = static_cast<uint32_t>(count);
+		sqe->off = static_cast<uint64_t>(offset);
+	}));
+}
+
+int sched::uringFsync(int fd, bool dataOnly)
+{
+	if (!netpollCurrent())
+	{
+		return dataOnly ? ::fdatasync(fd) : ::fsync(fd);
+	}
+
+	return static_cast<int>(uringResult(ringSubmit([=](io_uring_sqe* sqe) {
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->fd = fd;
+		sqe->fsync_flags = dataOnly ? IORING_FSYNC_DATASYNC : 0;
+	})));
+}
+
+int sched::uringAccept(int fd, sockaddr* addr, socklen_t* addrlen)
+{
+	if (!netpollCurrent())
+	{
+		return ::accept4(fd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	}
+
+	return static_cast<int>(uringResult(ringSubmit([=](io_uring_sqe* sqe) {
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = fd;
+		sqe->addr = reinterpret_cast<uintptr_t>(addr);
+		sqe->addr2 = reinterpret_cast<uintptr_t>(addrlen);
+		sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	})));
+}
+
+#else
+
+#if defined(__linux__)
+#include <cerrno>
+#include "sched/uring.h"
+
+bool sched::uringAvailable()
+{
+	return false;
+}
+
+static ssize_t uringUnavailable()
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+ssize_t sched::uringRead(int, void*, size_t, int64_t)
+{
+	return uringUnavailable();
+}
+
+ssize_t sched::uringWrite(int, const void*, size_t, int64_t)
+{
+	return uringUnavailable();
+}
+
+int sched::uringFsync(int, bool)
+{
+	return static_cast<int>(uringUnavailable());
+}
+
+int sched::uringAccept(int, sockaddr*, socklen_t*)
+{
+	return static_cast<int>(uringUnavailable());
+}
+#endif // defined(__linux__)
+
+IoRing* sched::uringCreate(NetPoller*)
+{
+	return nullptr;
+}
+
+void sched::uringDestroy(IoRing*)
+{
+}
+
+bool sched::uringFlush(IoRing*, bool)
+{
+	return false;
+}
+
+int sched::uringReap(IoRing*, Task**, int)
+{
+	return 0;
+}
+
+#endif // SCHED_IO_URING
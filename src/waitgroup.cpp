@@ -25,6 +25,7 @@
 */
 
 #include <cassert>
+#include "private.h"
 #include "sched/waitgroup.h"
 
 using namespace sched;
@@ -45,10 +46,7 @@ void WaitGroup::add(int delta)
 		assert(state.load() == st && "WaitGroup invariant violation");
 
 		state.store(0);
-		for (uint32_t ii = 0; ii != waiters; ++ii)
-		{
-			sema.release();
-		}
+		sema.release(waiters);
 	}
 }
 
@@ -61,10 +59,12 @@ void WaitGroup::wait()
 		const int32_t value = static_cast<int32_t>(st >> 32);
 		if (0 == value)
 		{
+			coopConsume();
 			return;
 		}
 
-		// add ourselves to the wait list, and block
+		// add ourselves to the wait list, and block. Sema::acquire spends
+		// the coop budget
 		const uint32_t waiters = static_cast<uint32_t>(st);
 		if (state.compare_exchange_weak(st, st + 1))
 		{